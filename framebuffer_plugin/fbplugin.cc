@@ -1,17 +1,34 @@
 #include "fbplugin.h"
 #include "plugin_shaders.h"
 #include "plugin_address.h"
-#include "../renderer/renderer/shaders/blinn_shader.h"
+#include "plugin_wait.h"
+#include "plugin_heap.h"
+#include "plugin_profile.h"
+#include "plugin_cost.h"
+#include "plugin_snapshot.h"
+#include "../renderer/renderer/core/texture.h"
 
 #include <riscv/mmio_plugin.h>
 #include <cstring>
 #include <cstdio>
+#include <cstdlib>
 #include <string>
 #include <vector>
+#include <unordered_map>
+#include <map>
 #include <utility>
+#include <algorithm>
 #include <thread>
 #include <iostream>
+#include <fstream>
+#include <iterator>
 #include <elf.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <unistd.h>
 
 struct framebuffer_plugin;
 
@@ -21,16 +38,164 @@ extern "C" int renderer_main(int argc, char *argv[]);
 struct framebuffer_plugin
 {
 	unsigned char* buffer;
-	size_t buffer_size;
-	std::vector<std::pair<void*, std::size_t>> allocations;
+	region_header_t layout = {};  // Layout of shared memory, also stored at its start.
+	std::string backing = "memfd"; // "memfd" or the path of a file backing shared memory.
+	bool hugetlb = false;         // Back shared memory with huge pages.
+	bool direct = false;          // Spike maps everything below cmd_offset as memory, this device only serves the rest.
+	plugin_heap heap{nullptr, 0}; // Allocations in shared memory, everything between the header and the mailboxes.
+	bool profile = false;         // Count spike accesses to shared memory by region.
+	mmio_profiler profiler;
+	bool costs = false;           // Let spike measure the cost of every shader invocation.
+	shader_cost_profiler cost_profiler;
+	const program_t* batch_program = nullptr; // Program of the fragment batch in flight.
+	std::vector<unsigned> batch_lanes;        // Lanes shading the fragment batch in flight.
+	std::unordered_map<const program_t*, std::string> program_names; // Fragment shader file and address of programs.
+	std::string snapshot_file;    // Decoded assets are kept in this file between runs, none if empty.
+	plugin_snapshot snapshot;
+	std::unordered_map<std::string, uint64_t> source_hashes; // Hash of the asset files looked up in the snapshot.
 	std::thread rendererThread;
+	adaptive_waiter ready_waiter; // Waits for spike to finish the commands posted to it.
+	bool lanes_ready = false;     // Every lane has announced itself (see PLUGIN_READY).
+	unsigned num_harts = 1;       // Number of harts taking commands in every spike process, must match spike -p.
+	unsigned num_workers = 0;     // Number of worker spike processes started next to this one.
+	unsigned worker = 0;          // Index of this process, 0 is the one running the renderer.
+	int shared_fd = -1;           // memfd backing the shared memory, inherited by the workers.
+	control_t local_control = {}; // Control block as seen by the guest of this process.
+	std::vector<pid_t> worker_pids;
+	std::vector<std::string> worker_command; // Command line of this process, the workers run it with more options.
+	size_t worker_device = 0;                // Argument of worker_command holding the plugin arguments.
+	std::vector<fs_ring_t*> fragment_rings; // One fragment ring per lane.
+	vs_output_t* vertex_stream = nullptr;   // PLUGIN_VS_STREAM_SIZE vertex outputs per lane.
+	bool guest_pipeline = false;  // Run draw calls entirely on spike.
+	bool guest_write = false;     // Let spike write shaded fragments to the framebuffer.
+	bool guest_textures = false;  // Let spike copy the uniforms and textures of a program to its own memory.
+	bool vector_shaders = false;  // Load the batch shaders of programs, which need the V extension.
+	precision_t fs_precision = PRECISION_FLOAT; // Precision of the fragment shaders programs should pick.
+	std::string reference_dir;    // Frames of float runs are saved here, other runs are compared with them.
+
+	// Copy of a program as seen by spike, with every pointer in the spike address space.
+	// The program is followed by its residency list and its batch shaders (see residency_t and batch_shaders_t).
+	struct program_slot
+	{
+		program_t* program = nullptr;
+		unsigned char* uniforms = nullptr;
+		std::vector<const void*> textures; // Textures in the residency list, in order.
+		uint64_t last_commit = 0;          // Commit that last made this slot current, 0 if never.
+	};
+	// Every commit of the uniforms of a program goes to one of UNIFORM_SLOTS copies, so that a command still running
+	// with an earlier commit is not disturbed. A commit equal to the contents of a slot makes it current without
+	// writing anything, which is what happens to the models that did not move since the previous frame (the passes of
+	// a frame take a slot each).
+	static const unsigned UNIFORM_SLOTS = 3;
+	struct program_image
+	{
+		const layout_t* uniform_layout = nullptr;
+		program_slot slots[UNIFORM_SLOTS];
+		program_slot* current = nullptr;   // Slot named by the commands, nullptr until the first commit.
+		void* vertex_batch = nullptr;      // Batch shaders, see batch_shaders_t.
+		void* fragment_batch = nullptr;
+	};
+	std::unordered_map<const program_t*, program_image> program_images;
+	std::vector<unsigned char> uniform_scratch; // Image of the uniforms being committed.
+	uint64_t uniform_commits = 0;
+	uint64_t uniform_writes = 0;  // Commits that had to write a slot.
+	// Images of structs referenced from uniforms (textures, cubemaps, ...), built on first use.
+	std::unordered_map<const void*, unsigned char*> images;
+	// Version of every image, changed when it is built and whenever its contents are invalidated, so that spike
+	// never mistakes a texture for an older one at the same address.
+	std::unordered_map<const void*, uint64_t> image_versions;
+	uint64_t last_version = 0;
+	uint64_t last_generation = 0; // Number of commits of uniforms so far.
+	uint64_t last_epoch = 0;      // Number of commands naming a program so far.
+	// Loaded shaders by FNV-1a hash of the ELF file, shared by every program using the same binary.
+	struct shader_image
+	{
+		unsigned char* allocation = nullptr;
+		void* entry = nullptr;
+		unsigned refs = 0;
+	};
+	std::unordered_map<uint64_t, shader_image> shader_cache;
+	// Hash of the shader files read so far, only valid while their inode, size and modification time match. The time
+	// is compared to the nanosecond, a rebuild within the same second must not reuse the old image; the inode catches
+	// a file replaced by another one (the linker writes a new file) that happens to keep size and time.
+	struct shader_file
+	{
+		ino_t ino;
+		off_t size;
+		struct timespec mtime;
+		uint64_t hash;
+
+		bool matches(const struct stat& st) const
+		{
+			return ino == st.st_ino && size == st.st_size && mtime.tv_sec == st.st_mtim.tv_sec
+			    && mtime.tv_nsec == st.st_mtim.tv_nsec;
+		}
+	};
+	std::unordered_map<std::string, shader_file> shader_files;
+	// Shader of a program, by program and shader type (sdr_type of plugin_set_shader).
+	std::map<std::pair<const program_t*, char>, uint64_t> shaders;
+	static const char NUM_SHADER_TYPES = 4;
+	static const uint64_t SHADER_ALIGN = 4096; // Alignment of shader images in the spike address space.
 
 	framebuffer_plugin(const std::string& args)
 	{
 		std::cout << "plugin created with args: " << args << "\n";
 		fb_plugin = this;
-		buffer = (unsigned char*) std::malloc(0x9600000);
-		buffer_size = 0;
+		layout.size = PLUGIN_DEFAULT_MEM_SIZE;
+		std::string scene = parse_args(args);
+		num_workers = std::min(num_workers, PLUGIN_MAX_LANES / num_harts - 1);
+		if (direct && backing == "memfd") {
+			std::fprintf(stderr, "framebuffer_plugin: direct=on needs a backing file that spike can map, ignored\n");
+			direct = false;
+		}
+		if (guest_pipeline && fs_precision != PRECISION_FLOAT) {
+			// The guest pipeline interpolates float varyings for the fragment shader itself.
+			std::fprintf(stderr, "framebuffer_plugin: precision needs pipeline=host, using float\n");
+			fs_precision = PRECISION_FLOAT;
+		}
+		map_shared_memory();
+		if (direct && !worker)
+			std::printf("direct: spike needs --shared-mem=%#x:%#lx:%s and the device at %#lx\n", PLUGIN_BASE_ADDR,
+			            layout.cmd_offset, backing.c_str(), PLUGIN_BASE_ADDR + layout.cmd_offset);
+		heap = plugin_heap(buffer + sizeof(region_header_t), layout.cmd_offset - sizeof(region_header_t));
+		if (!worker && !snapshot_file.empty())
+			snapshot.open(snapshot_file);
+
+		// The lanes depend on the number of workers, which must be known before anything is sized by them.
+		if (!worker && num_workers && !find_worker_command(args)) {
+			std::fprintf(stderr, "framebuffer_plugin: plugin arguments not found on the command line, "
+			             "not starting workers\n");
+			num_workers = 0;
+		}
+		local_control.num_lanes = num_lanes();
+		local_control.num_harts = num_harts;
+		local_control.lane_base = worker * num_harts;
+		local_control.costs = costs;
+		if (worker) {
+			// Workers only serve the guest, everything else is done by the renderer process.
+			std::printf("worker %u serving lanes %u to %u\n", worker, worker * num_harts, (worker + 1) * num_harts - 1);
+			return;
+		}
+
+		if (profile) {
+			profiler.enable(layout.size);
+			profiler.mark(0, sizeof(layout), mmio_profiler::HEADER);
+			profiler.mark(layout.cmd_offset, PLUGIN_CMD_SIZE, mmio_profiler::MAILBOX);
+		}
+		std::memcpy(buffer, &layout, sizeof(layout));
+		std::memset(PLUGIN_CONTROL(buffer), 0, PLUGIN_MAILBOXES_SIZE + PLUGIN_COSTS_SIZE);
+		std::memcpy(PLUGIN_CONTROL(buffer), &local_control, sizeof(control_t));
+		for (unsigned lane = 0; lane < num_lanes(); ++lane) {
+			fs_ring_t* ring = static_cast<fs_ring_t*>(allocate(sizeof(fs_ring_t), PLUGIN_TAG_VARYINGS));
+			std::memset(ring, 0, sizeof(fs_ring_t));
+			fragment_rings.push_back(ring);
+		}
+		vertex_stream = static_cast<vs_output_t*>(allocate(num_lanes() * PLUGIN_VS_STREAM_SIZE * sizeof(vs_output_t),
+		                                                   PLUGIN_TAG_VARYINGS));
+		if (num_workers) {
+			ready_waiter.sleep_poll = std::chrono::microseconds(100);
+			spawn_workers();
+		}
 
 		int argc = 3;
 		char **argv = (char**) std::malloc(4 * sizeof(char*));
@@ -38,21 +203,46 @@ struct framebuffer_plugin
 			argv[i] = (char*) std::malloc(50);
 		std::strcpy(argv[0], "./Viewer");
 		std::strcpy(argv[1], "blinn");
-		std::strcpy(argv[2], args.c_str()); // TODO: Fix inconsistent assertion failure when scene is other than "triangle" e.g. "mccree"
+		std::strcpy(argv[2], scene.c_str());
 		argv[3] = nullptr;
+		// The renderer loads the scene while spike boots, its first command waits for every lane to be ready.
 		rendererThread = std::thread(renderer_main, argc, argv);
 	}
 
 	~framebuffer_plugin()
 	{
-		rendererThread.join();
-		std::free(buffer);
+		if (rendererThread.joinable())
+			rendererThread.join();
+		for (pid_t pid : worker_pids)
+			waitpid(pid, nullptr, 0);
+		if (!worker) {
+			ready_waiter.report(stdout);
+			std::printf("uniforms: %lu commits, %lu written, the rest matched a slot\n", uniform_commits,
+			            uniform_writes);
+			heap.report(stdout);
+			if (profiler.enabled())
+				profiler.report(stdout);
+			if (costs)
+				cost_profiler.report(stdout);
+		}
+		munmap(buffer, layout.size);
+		close(shared_fd);
 		std::cout << "plugin destroyed..." << "\n";
 	}
 
 	bool load(reg_t offset, size_t len, uint8_t* bytes)
 	{
-		std::memcpy(bytes,  &buffer[offset], len);
+		if (direct)
+			offset += layout.cmd_offset;
+		if (offset + len > layout.size)
+			return false;
+		// The control block differs between processes, so it is not read from shared memory.
+		if (offset >= layout.cmd_offset && offset + len <= layout.cmd_offset + sizeof(control_t))
+			std::memcpy(bytes, reinterpret_cast<unsigned char*>(&local_control) + (offset - layout.cmd_offset), len);
+		else
+			std::memcpy(bytes, &buffer[offset], len);
+		if (profiler.enabled())
+			profiler.record(offset, len, mmio_profiler::LOAD);
 #ifdef PLUGIN_DEBUG
     	std::printf("Load offset=%lx, len=%lx , value %x\n", offset, len, buffer[offset]);
 #endif
@@ -61,229 +251,844 @@ struct framebuffer_plugin
 
 	bool store(reg_t offset, size_t len, const uint8_t* bytes)
 	{
+		if (direct)
+			offset += layout.cmd_offset;
+		if (offset + len > layout.size)
+			return false;
 		std::memcpy(&buffer[offset], bytes, len);
+		if (profiler.enabled())
+			profiler.record(offset, len, mmio_profiler::STORE);
+		if (offset >= layout.cmd_offset && offset < layout.cmd_offset + PLUGIN_MAILBOXES_SIZE)
+			ready_waiter.notify();
 #ifdef PLUGIN_DEBUG
         std::printf("Store offset=%lx, len=%lx , value %x\n", offset, len, buffer[offset]);
 #endif
 		return true;
 	}
 
-	void* allocate(size_t requested_size)
+	void* allocate(size_t size, plugin_tag_t tag)
+	{
+		void* ptr = heap.allocate(size, tag);
+		if (!ptr) {
+			// Callers do not expect failure, and going past the heap would overwrite the mailboxes and shaders.
+			std::fprintf(stderr, "%s: out of shared memory allocating %zu bytes\n", __func__, size);
+			heap.report(stderr);
+			std::abort();
+		}
+		profiler.mark(static_cast<unsigned char*>(ptr) - buffer, size, tag);
+		return ptr;
+	}
+
+	void deallocate(void* ptr)
 	{
-		if (buffer_size % 16 != 0)
-			buffer_size += (16 - buffer_size % 16);
-		void* allocation_address = &buffer[buffer_size];
-		buffer_size += requested_size;
+		if (!ptr)
+			return;
+
+		// Images built from ptr go with it
+		auto image = images.find(ptr);
+		if (image != images.end()) {
+			heap.deallocate(image->second);
+			images.erase(image);
+		}
+		image_versions.erase(ptr);
+		for (char type = 0; type < NUM_SHADER_TYPES; ++type) {
+			auto shader = shaders.find(std::make_pair(static_cast<const program_t*>(ptr), type));
+			if (shader != shaders.end()) {
+				release_shader(shader->second);
+				shaders.erase(shader);
+			}
+		}
+		program_names.erase(static_cast<program_t*>(ptr));
+		auto program = program_images.find(static_cast<program_t*>(ptr));
+		if (program != program_images.end()) {
+			for (program_slot& slot : program->second.slots) {
+				if (slot.program) {
+					heap.deallocate(slot.program);
+					heap.deallocate(slot.uniforms);
+				}
+			}
+			program_images.erase(program);
+		}
 
-		std::printf("Allocated address %p, total allocation size is now %zu bytes.\n", allocation_address, buffer_size);
+		size_t size = heap.deallocate(ptr);
+		if (!size)
+			std::fprintf(stderr, "%s: %p is not a live allocation\n", __func__, ptr);
+		profiler.mark(static_cast<unsigned char*>(ptr) - buffer, size, mmio_profiler::UNALLOCATED);
+	}
 
-		return allocation_address;
+	void set_uniform_layout(program_t *program, const layout_t *layout)
+	{
+		program_image& image = program_images[program];
+		image.uniform_layout = layout;
 	}
 
-	void deallocate(void* ptr)
+	void commit_uniforms(program_t *program)
+	{
+		program_image& image = program_images[program];
+		layout_t plain = {program->sizeof_uniforms, 0, nullptr};
+		const layout_t* layout = image.uniform_layout ? image.uniform_layout : &plain;
+		uniform_scratch.resize(program->sizeof_uniforms);
+		build_image(program->shader_uniforms, layout, uniform_scratch.data());
+
+		program_t copy = *program;
+		copy.vertex_shader = reinterpret_cast<vertex_shader_t*>(to_spike(reinterpret_cast<void*>(program->vertex_shader)));
+		copy.fragment_shader = reinterpret_cast<fragment_shader_t*>(to_spike(reinterpret_cast<void*>(program->fragment_shader)));
+		for (int i = 0; i < 3; ++i)
+			copy.shader_attribs[i] = reinterpret_cast<void*>(to_spike(program->shader_attribs[i]));
+		copy.shader_varyings = reinterpret_cast<void*>(to_spike(program->shader_varyings));
+		for (int i = 0; i < MAX_VARYINGS; ++i) {
+			copy.in_varyings[i] = reinterpret_cast<void*>(to_spike(program->in_varyings[i]));
+			copy.out_varyings[i] = reinterpret_cast<void*>(to_spike(program->out_varyings[i]));
+		}
+
+		// Reuse a slot with the same contents, otherwise overwrite the one committed least recently. That is never
+		// the current slot nor the one before it, so neither the command in flight nor the next one reads it.
+		++uniform_commits;
+		program_slot* target = nullptr;
+		for (program_slot& slot : image.slots) {
+			if (slot.program) {
+				copy.shader_uniforms = reinterpret_cast<void*>(to_spike(slot.uniforms));
+				if (std::memcmp(slot.uniforms, uniform_scratch.data(), program->sizeof_uniforms) == 0
+				    && std::memcmp(slot.program, &copy, sizeof(program_t)) == 0) {
+					slot.last_commit = uniform_commits;
+					image.current = &slot;
+					return;
+				}
+			}
+			if (!target || slot.last_commit < target->last_commit)
+				target = &slot;
+		}
+		if (!target->program) {
+			target->program = static_cast<program_t*>(allocate(sizeof(program_t) + sizeof(residency_t)
+			                                                   + sizeof(batch_shaders_t), PLUGIN_TAG_PROGRAM));
+			target->uniforms = static_cast<unsigned char*>(allocate(program->sizeof_uniforms, PLUGIN_TAG_UNIFORMS));
+		}
+		std::memcpy(target->uniforms, uniform_scratch.data(), program->sizeof_uniforms);
+		copy.shader_uniforms = reinterpret_cast<void*>(to_spike(target->uniforms));
+		std::memcpy(target->program, &copy, sizeof(program_t));
+		target->last_commit = uniform_commits;
+		image.current = target;
+		++uniform_writes;
+
+		// Textures referenced directly from the uniforms can be made resident, nested ones (cubemap faces) can not.
+		residency_t* residency = reinterpret_cast<residency_t*>(target->program + 1);
+		target->textures.clear();
+		for (int i = 0; guest_textures && i < layout->num_relocs; ++i) {
+			const reloc_t& reloc = layout->relocs[i];
+			const void* texture;
+			std::memcpy(&texture, static_cast<const unsigned char*>(program->shader_uniforms) + reloc.offset,
+			            sizeof(texture));
+			if (reloc.target != &texture_layout || !texture
+			    || target->textures.size() == PLUGIN_MAX_RESIDENT_TEXTURES)
+				continue;
+			residency->textures[target->textures.size()].offset = reloc.offset;
+			target->textures.push_back(texture);
+		}
+		residency->generation = ++last_generation;
+		residency->sizeof_uniforms = guest_textures ? program->sizeof_uniforms : 0;
+		residency->num_textures = target->textures.size();
+	}
+
+	// Make spike copy obj again before its next use.
+	void invalidate(const void* obj)
 	{
-		// Not implemented
+		image_versions[obj] = ++last_version;
 	}
 
 	vec4_t invoke_fragment_shader(program_t *program, int *discard, int backface)
 	{
-		uint64_t ret_args[5];
-		structs_to_spike(program);
+		wait_lanes_ready();
+		finish_fragment_batch();
+		mailbox_t* mb = mailbox(0);
+		reg_t spike_program = spike_program_image(program);
 
-		recv_msg(buffer, PLUGIN_CMD_READY, NULL);
-		send_msg(buffer, PLUGIN_CMD_FS, 3, program, *discard, backface);
-		recv_msg(buffer, PLUGIN_CMD_READY, ret_args);
+		send_msg(mb, PLUGIN_CMD_FS, 3, spike_program, *discard, backface);
+		wait_done(0, 1);
+		collect_cost(program, 0);
 
-		structs_to_host(program);
-		*discard = ret_args[0];
+		*discard = mb->args[0];
 		vec4_t color;
-		color.x = * (float*) &ret_args[1];
-		color.y = * (float*) &ret_args[2];
-		color.z = * (float*) &ret_args[3];
-		color.w = * (float*) &ret_args[4];
+		color.x = bits_to_float(mb->args[1]);
+		color.y = bits_to_float(mb->args[2]);
+		color.z = bits_to_float(mb->args[3]);
+		color.w = bits_to_float(mb->args[4]);
 		return color;
 	}
 
+	void post_fragment_shader_batch(program_t *program, framebuffer_t *framebuffer)
+	{
+		wait_lanes_ready();
+		finish_fragment_batch();
+		reg_t spike_program = spike_program_image(program);
+		reg_t spike_framebuffer = spike_image(framebuffer, &framebuffer_layout);
+
+		// Every lane shades its own ring up to the current head, idle lanes are not woken up. The host may queue
+		// more jobs while the batch runs.
+		batch_program = program;
+		batch_lanes.clear();
+		for (unsigned lane = 0; lane < num_lanes(); ++lane) {
+			fs_ring_t* ring = fragment_rings[lane];
+			uint64_t head = ring->head;
+			if (head != ring->tail) {
+				send_msg(mailbox(lane), PLUGIN_CMD_FS_BATCH, 4, spike_program, spike_framebuffer, to_spike(ring),
+				         head);
+				batch_lanes.push_back(lane);
+			}
+		}
+	}
+
+	void wait_fragment_shader_batch()
+	{
+		wait_done(0, num_lanes());
+		for (unsigned lane : batch_lanes)
+			collect_cost(batch_program, lane);
+		batch_lanes.clear();
+	}
+
+	// A mailbox holds a single command, so nothing may be posted to a lane before it is done with the previous one.
+	// Every command waits for the fragment batch that may still be in flight, the renderer picks up its results the
+	// next time it waits for the batch.
+	void finish_fragment_batch()
+	{
+		if (!batch_lanes.empty())
+			wait_fragment_shader_batch();
+	}
+
+	fs_ring_t* fragment_ring(int lane)
+	{
+		return fragment_rings[lane];
+	}
+
+	unsigned num_lanes() const
+	{
+		return num_harts * (num_workers + 1);
+	}
+
+	vs_output_t* invoke_vertex_shader_batch(program_t *program, const void *attribs, int stride, int count)
+	{
+		wait_lanes_ready();
+		finish_fragment_batch();
+		const unsigned char* first_vertex = static_cast<const unsigned char*>(attribs);
+		reg_t spike_program = spike_program_image(program);
+		int per_lane = (count + num_lanes() - 1) / num_lanes();
+
+		// Split the range evenly, the outputs end up in order in the stream.
+		for (unsigned lane = 0; lane < num_lanes(); ++lane) {
+			int first = lane * per_lane;
+			int n = std::min(per_lane, count - first);
+			if (n <= 0)
+				break;
+			send_msg(mailbox(lane), PLUGIN_CMD_VS_BATCH, 5, spike_program, to_spike(first_vertex + first * stride),
+			         stride, n, to_spike(vertex_stream + first));
+		}
+		wait_done(0, num_lanes());
+		for (unsigned lane = 0; lane < num_lanes() && int(lane) * per_lane < count; ++lane)
+			collect_cost(program, lane);
+
+		return vertex_stream;
+	}
+
+	void invoke_draw_mesh(framebuffer_t *framebuffer, program_t *program, const void *vertices, int stride, int count)
+	{
+		wait_lanes_ready();
+		finish_fragment_batch();
+		reg_t spike_program = spike_program_image(program);
+		reg_t spike_framebuffer = spike_image(framebuffer, &framebuffer_layout);
+
+		// Every lane runs the whole draw call, but only rasterizes its own tiles.
+		for (unsigned lane = 0; lane < num_lanes(); ++lane)
+			send_msg(mailbox(lane), PLUGIN_CMD_DRAW_MESH, 5, spike_program, to_spike(vertices), stride, count,
+			         spike_framebuffer);
+		wait_done(0, num_lanes());
+		for (unsigned lane = 0; lane < num_lanes(); ++lane)
+			collect_cost(program, lane);
+	}
+
 	vec4_t invoke_vertex_shader(program_t *program, int i)
 	{
-		uint64_t ret_args[4];
-		structs_to_spike(program);
+		wait_lanes_ready();
+		finish_fragment_batch();
+		mailbox_t* mb = mailbox(0);
+		reg_t spike_program = spike_program_image(program);
 
-		recv_msg(buffer, PLUGIN_CMD_READY, NULL);
-		send_msg(buffer, PLUGIN_CMD_VS, 2, program, i);
-		recv_msg(buffer, PLUGIN_CMD_READY, ret_args);
+		send_msg(mb, PLUGIN_CMD_VS, 2, spike_program, i);
+		wait_done(0, 1);
+		collect_cost(program, 0);
 
-		structs_to_host(program);
 		vec4_t rv;
-		rv.x = * (float*) &ret_args[0];
-		rv.y = * (float*) &ret_args[1];
-		rv.z = * (float*) &ret_args[2];
-		rv.w = * (float*) &ret_args[3];
+		rv.x = bits_to_float(mb->args[0]);
+		rv.y = bits_to_float(mb->args[1]);
+		rv.z = bits_to_float(mb->args[2]);
+		rv.w = bits_to_float(mb->args[3]);
 		return rv;
 	}
 
 	void invoke_update_fbaddr(unsigned char* addr)
 	{
-		// convert to spike address space first
-		if (addr)
-			addr = (addr - buffer) + reinterpret_cast<unsigned char*>(PLUGIN_BASE_ADDR);
-		recv_msg(buffer, PLUGIN_CMD_READY, NULL);
-		send_msg(buffer, PLUGIN_CMD_FBADDR, 1, addr);
-		recv_msg(buffer, PLUGIN_CMD_READY, NULL);
-		printf("%s: Updated fbaddr to %p\n", __func__, addr);
+		wait_lanes_ready();
+		finish_fragment_batch();
+		reg_t spike_addr = to_spike(addr);
+		send_msg(mailbox(0), PLUGIN_CMD_FBADDR, 1, spike_addr);
+		wait_done(0, 1);
+		printf("%s: Updated fbaddr to %#lx\n", __func__, spike_addr);
 	}
 
 	void invoke_draw(uint32_t pixel, ptrdiff_t offset)
 	{
-		recv_msg(buffer, PLUGIN_CMD_READY, NULL);
-		send_msg(buffer, PLUGIN_CMD_DRAW, 2, pixel, offset);
-		recv_msg(buffer, PLUGIN_CMD_READY, NULL);
+		wait_lanes_ready();
+		finish_fragment_batch();
+		send_msg(mailbox(0), PLUGIN_CMD_DRAW, 2, pixel, offset);
+		wait_done(0, 1);
 	}
 
 	void shutdown()
 	{
-		recv_msg(buffer, PLUGIN_CMD_READY, NULL);
-		send_msg(buffer, PLUGIN_CMD_STOP, 0);
+		wait_lanes_ready();
+		finish_fragment_batch();
+		// Lane 0 ends the simulation of this process, so stop it last.
+		for (unsigned lane = num_lanes(); lane-- > 0; )
+			send_msg(mailbox(lane), PLUGIN_CMD_STOP, 0);
+	}
+
+	// Set the shader of a program. Shader images are shared by content, a file that has not changed since it was last
+	// loaded is not read again.
+	void* load_shader(program_t* program, const char* file_name, char sdr_type)
+	{
+		if (sdr_type >= 2 && !vector_shaders)
+			return nullptr;
+		uint64_t hash;
+		struct stat st = {};
+		auto file = shader_files.find(file_name);
+		bool unchanged = stat(file_name, &st) == 0 && file != shader_files.end() && file->second.matches(st)
+		              && shader_cache.count(file->second.hash);
+		if (unchanged) {
+			hash = file->second.hash;
+		} else {
+			std::vector<unsigned char> elf;
+			if (!read_file(file_name, elf))
+				return nullptr;
+			hash = fnv1a(elf.data(), elf.size());
+			if (!shader_cache.count(hash)) {
+				shader_image image;
+				if (!load_elf(elf, image))
+					return nullptr;
+				shader_cache.emplace(hash, image);
+			}
+			shader_files[file_name] = shader_file{st.st_ino, st.st_size, st.st_mtim, hash};
+		}
+
+		// Replace the previous shader of the program
+		auto key = std::make_pair(static_cast<const program_t*>(program), sdr_type);
+		shader_image& image = shader_cache[hash];
+		++image.refs;
+		auto previous = shaders.find(key);
+		if (previous != shaders.end()) {
+			release_shader(previous->second);
+			previous->second = hash;
+		} else {
+			shaders.emplace(key, hash);
+		}
+		if (sdr_type == 2)
+			program_images[program].fragment_batch = image.entry;
+		else if (sdr_type == 3)
+			program_images[program].vertex_batch = image.entry;
+		if (!sdr_type) {
+			char name[32];
+			std::snprintf(name, sizeof(name), " %p", static_cast<void*>(program));
+			program_names[program] = file_name + std::string(name);
+		}
+		return image.entry;
+	}
+
+	// Decoded asset of the given kind from source, if the snapshot has one made from the same contents of source.
+	const void* snapshot_find(const char* source, const char* kind, size_t* size)
+	{
+		if (!snapshot.enabled())
+			return nullptr;
+		std::vector<unsigned char> contents;
+		if (!read_file(source, contents))
+			return nullptr;
+		uint64_t hash = fnv1a(contents.data(), contents.size());
+		source_hashes[source] = hash;
+		return snapshot.find(std::string(kind) + ":" + source, hash, size);
+	}
+
+	// Keep an asset decoded from source, which must have been looked up with snapshot_find before.
+	void snapshot_add(const char* source, const char* kind, const void* header, size_t header_size,
+	                  const void* payload, size_t payload_size)
+	{
+		auto hash = source_hashes.find(source);
+		if (snapshot.enabled() && hash != source_hashes.end())
+			snapshot.add(std::string(kind) + ":" + source, hash->second, header, header_size, payload, payload_size);
+	}
+
+	void snapshot_save()
+	{
+		snapshot.save();
+	}
+
+	void set_pass(const char* name)
+	{
+		cost_profiler.set_pass(name);
+	}
+
+	void end_frame()
+	{
+		if (profiler.enabled())
+			profiler.end_frame(stdout);
+		if (costs)
+			cost_profiler.end_frame(stdout);
+	}
+
+private:
+	// Parse the plugin arguments "scene[,key=value...]" and return the scene.
+	std::string parse_args(const std::string& args)
+	{
+		std::string scene;
+		size_t start = 0;
+		while (start <= args.size()) {
+			size_t end = args.find(',', start);
+			if (end == std::string::npos)
+				end = args.size();
+			std::string arg = args.substr(start, end - start);
+			size_t eq = arg.find('=');
+			if (start == 0 && eq == std::string::npos)
+				scene = arg;
+			else if (eq != std::string::npos && !set_option(arg.substr(0, eq), arg.substr(eq + 1)))
+				std::fprintf(stderr, "%s: ignoring unknown option '%s'\n", __func__, arg.c_str());
+			start = end + 1;
+		}
+		return scene;
+	}
+
+	bool set_option(const std::string& key, const std::string& value)
+	{
+		if (key == "spin")
+			ready_waiter.spin_limit = std::strtoul(value.c_str(), nullptr, 0);
+		else if (key == "yield")
+			ready_waiter.yield_limit = std::strtoul(value.c_str(), nullptr, 0);
+		else if (key == "harts")
+			num_harts = std::max(1ul, std::min(std::strtoul(value.c_str(), nullptr, 0), (unsigned long) PLUGIN_MAX_HARTS));
+		else if (key == "size")
+			layout.size = parse_size(value);
+		else if (key == "backing")
+			backing = value;
+		else if (key == "snapshot")
+			snapshot_file = value;
+		else if (key == "hugetlb" && (value == "on" || value == "off"))
+			hugetlb = value == "on";
+		else if (key == "direct" && (value == "on" || value == "off"))
+			direct = value == "on";
+		else if (key == "profile" && (value == "on" || value == "off"))
+			profile = value == "on";
+		else if (key == "costs" && (value == "on" || value == "off"))
+			costs = value == "on";
+		else if (key == "workers")
+			num_workers = std::strtoul(value.c_str(), nullptr, 0);
+		else if (key == "worker")
+			worker = std::strtoul(value.c_str(), nullptr, 0);
+		else if (key == "fd")
+			shared_fd = std::strtol(value.c_str(), nullptr, 0);
+		else if (key == "pipeline" && (value == "guest" || value == "host"))
+			guest_pipeline = value == "guest";
+		else if (key == "write" && (value == "guest" || value == "host"))
+			guest_write = value == "guest";
+		else if (key == "textures" && (value == "guest" || value == "host"))
+			guest_textures = value == "guest";
+		else if (key == "vector" && (value == "on" || value == "off"))
+			vector_shaders = value == "on";
+		else if (key == "precision" && (value == "float" || value == "fixed" || value == "half"))
+			fs_precision = value == "fixed" ? PRECISION_FIXED : value == "half" ? PRECISION_HALF : PRECISION_FLOAT;
+		else if (key == "reference")
+			reference_dir = value;
+		else
+			return false;
+		return true;
+	}
+
+	// Size with an optional K, M or G suffix.
+	static uint64_t parse_size(const std::string& value)
+	{
+		char* end;
+		uint64_t size = std::strtoull(value.c_str(), &end, 0);
+		switch (*end) {
+		case 'G': case 'g': size <<= 10; // fall through
+		case 'M': case 'm': size <<= 10; // fall through
+		case 'K': case 'k': size <<= 10;
+		}
+		return size;
+	}
+
+	// Place the control block at the end of shared memory, the rest is left for allocations.
+	bool compute_layout()
+	{
+		const uint64_t page = hugetlb ? 2 << 20 : 4 << 10;
+		layout.magic = PLUGIN_MAGIC;
+		layout.size = (layout.size + page - 1) / page * page;
+		if (layout.size > PLUGIN_MAX_MEM_SIZE || layout.size < PLUGIN_CMD_SIZE + (1 << 20))
+			return false;
+		layout.cmd_offset = layout.size - PLUGIN_CMD_SIZE;
+		return true;
+	}
+
+	// Create the file or memfd backing shared memory, returns -1 on failure.
+	int create_backing()
+	{
+		int fd;
+		if (backing == "memfd")
+			fd = memfd_create("framebuffer_plugin", hugetlb ? MFD_HUGETLB : 0);
+		else
+			fd = open(backing.c_str(), O_RDWR | O_CREAT, 0600);
+		if (fd >= 0 && ftruncate(fd, layout.size) != 0) {
+			close(fd);
+			fd = -1;
+		}
+		return fd;
+	}
+
+	// Map the shared memory. The renderer process creates it, the workers get its fd from the fd option.
+	// Other processes can map the same memory through the backing file, the header at its start describes the layout.
+	void map_shared_memory()
+	{
+		if (!compute_layout()) {
+			std::fprintf(stderr, "%s: invalid size=%#lx, using the default size\n", __func__, layout.size);
+			layout.size = PLUGIN_DEFAULT_MEM_SIZE;
+			compute_layout();
+		}
+
+		void* mapping = MAP_FAILED;
+		if (!worker)
+			shared_fd = create_backing();
+		if (shared_fd >= 0)
+			mapping = mmap(nullptr, layout.size, PROT_READ | PROT_WRITE, MAP_SHARED, shared_fd, 0);
+		if (mapping == MAP_FAILED && hugetlb && !worker) {
+			// Huge pages must be reserved in advance (vm.nr_hugepages), fall back to normal pages.
+			std::perror("framebuffer_plugin: huge pages unavailable");
+			if (shared_fd >= 0)
+				close(shared_fd);
+			hugetlb = false;
+			shared_fd = create_backing();
+			if (shared_fd >= 0)
+				mapping = mmap(nullptr, layout.size, PROT_READ | PROT_WRITE, MAP_SHARED, shared_fd, 0);
+		}
+		if (mapping == MAP_FAILED) {
+			std::perror("framebuffer_plugin: failed to map shared memory");
+			std::abort();
+		}
+		if (!hugetlb)
+			madvise(mapping, layout.size, MADV_HUGEPAGE); // Transparent huge pages where the backing allows it.
+		buffer = static_cast<unsigned char*>(mapping);
+		std::printf("shared memory: %#lx bytes (%s%s), allocations below %#lx\n", layout.size, backing.c_str(),
+		            hugetlb ? ", huge pages" : "", layout.cmd_offset);
+	}
+
+	// Start the workers by running spike again with the same command line, only with worker=N and fd=F appended to
+	// the plugin arguments. shared_fd is not close-on-exec, so the workers inherit it.
+	// Find the plugin arguments on the command line of this process, false if they are not there.
+	bool find_worker_command(const std::string& args)
+	{
+		std::ifstream cmdline_file("/proc/self/cmdline", std::ios::binary);
+		std::string cmdline((std::istreambuf_iterator<char>(cmdline_file)), std::istreambuf_iterator<char>());
+		std::vector<std::string> cmd_args;
+		for (size_t start = 0, end; start < cmdline.size(); start = end + 1) {
+			end = cmdline.find('\0', start);
+			if (end == std::string::npos)
+				end = cmdline.size();
+			cmd_args.push_back(cmdline.substr(start, end - start));
+		}
+
+		size_t device = 0;
+		while (device < cmd_args.size() && (cmd_args[device].find("framebuffer_plugin") == std::string::npos
+		       || cmd_args[device].size() < args.size()
+		       || cmd_args[device].compare(cmd_args[device].size() - args.size(), args.size(), args) != 0))
+			++device;
+		if (device == cmd_args.size())
+			return false;
+		worker_command = cmd_args;
+		worker_device = device;
+		return true;
+	}
+
+	void spawn_workers()
+	{
+		for (unsigned i = 1; i <= num_workers; ++i) {
+			std::vector<std::string> worker_args = worker_command;
+			worker_args[worker_device] += ",worker=" + std::to_string(i) + ",fd=" + std::to_string(shared_fd);
+			std::vector<char*> argv;
+			for (std::string& arg : worker_args)
+				argv.push_back(&arg[0]);
+			argv.push_back(nullptr);
+
+			pid_t pid = fork();
+			if (pid == 0) {
+				execv("/proc/self/exe", argv.data());
+				std::perror("framebuffer_plugin: failed to start worker");
+				_exit(127);
+			}
+			if (pid < 0) {
+				// The guest already counts on every lane, so running with fewer is not an option.
+				std::perror("framebuffer_plugin: fork");
+				stop_workers();
+				std::abort();
+			}
+			worker_pids.push_back(pid);
+		}
+	}
+
+	// Kill and reap the workers started so far, so that none outlives a failed start.
+	void stop_workers()
+	{
+		for (pid_t pid : worker_pids)
+			kill(pid, SIGKILL);
+		for (pid_t pid : worker_pids)
+			waitpid(pid, nullptr, 0);
+		worker_pids.clear();
+	}
+
+	mailbox_t* mailbox(unsigned lane)
+	{
+		return PLUGIN_MAILBOX(buffer, lane);
+	}
+
+	// Wait until the hart of every lane takes commands, called before posting any, so that no command reaches a
+	// guest that is still booting. Only the first call waits.
+	void wait_lanes_ready()
+	{
+		if (lanes_ready)
+			return;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		// Lanes of workers announce themselves from other processes, which cannot call notify().
+		adaptive_waiter boot_waiter;
+		boot_waiter.sleep_poll = std::chrono::milliseconds(1);
+		boot_waiter.wait([this] {
+			check_workers_alive();
+			for (unsigned lane = 0; lane < num_lanes(); ++lane)
+				if (!lane_ready(buffer, lane))
+					return false;
+			return true;
+		});
+		lanes_ready = true;
+		std::printf("startup: %u lanes ready, renderer waited %.3f ms for spike\n", num_lanes(),
+		            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+	}
+
+	// Abort if a worker has exited while its lanes are still awaited (e.g. its execv failed), the wait would never end.
+	void check_workers_alive()
+	{
+		for (size_t i = 0; i < worker_pids.size(); ++i) {
+			int status;
+			if (waitpid(worker_pids[i], &status, WNOHANG) != worker_pids[i])
+				continue;
+			unsigned first = (i + 1) * num_harts;
+			unsigned lane = first;
+			while (lane < first + num_harts && lane_ready(buffer, lane))
+				++lane;
+			std::fprintf(stderr, "framebuffer_plugin: worker %zu exited (status %#x) before lane %u announced itself\n",
+			             i + 1, status, lane);
+			worker_pids.erase(worker_pids.begin() + i);
+			stop_workers();
+			std::abort();
+		}
+	}
+
+	// Wait until spike has finished the last command posted to every lane in [first, last).
+	void wait_done(unsigned first, unsigned last)
+	{
+		ready_waiter.wait([this, first, last] {
+			for (unsigned lane = first; lane < last; ++lane)
+				if (!msg_done(mailbox(lane)))
+					return false;
+			return true;
+		});
+	}
+
+	// Add the cost reported by lane for its last command, which ran shaders of program.
+	void collect_cost(const program_t* program, unsigned lane)
+	{
+		if (!costs)
+			return;
+		auto name = program_names.find(program);
+		cost_profiler.add(program, name != program_names.end() ? name->second : "?", *PLUGIN_LANE_COST(buffer, lane));
 	}
 
-	void* load_shader(const char* file_name, char sdr_type)
+	static float bits_to_float(uint64_t bits)
 	{
-		ptrdiff_t offset = PLUGIN_FS_OFFSET;
-		if (sdr_type)
-			offset = PLUGIN_VS_OFFSET;
+		uint32_t low = static_cast<uint32_t>(bits);
+		float f;
+		std::memcpy(&f, &low, sizeof(f));
+		return f;
+	}
 
+	static bool read_file(const char* file_name, std::vector<unsigned char>& contents)
+	{
 		FILE* f = fopen(file_name, "rb");
 		if (!f) {
 			std::fprintf(stderr, "%s: I/O failure (failed to open file)\n", __func__);
-			return nullptr;
+			return false;
+		}
+		unsigned char chunk[65536];
+		size_t n;
+		while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+			contents.insert(contents.end(), chunk, chunk + n);
+		bool ok = !ferror(f);
+		fclose(f);
+		if (!ok)
+			std::fprintf(stderr, "%s: I/O failure (failed to read file)\n", __func__);
+		return ok;
+	}
+
+	static uint64_t fnv1a(const unsigned char* data, size_t size)
+	{
+		uint64_t hash = 0xcbf29ce484222325ull;
+		for (size_t i = 0; i < size; ++i) {
+			hash ^= data[i];
+			hash *= 0x100000001b3ull;
 		}
+		return hash;
+	}
 
-		// Read ELF header
+	// Load the PT_LOAD segments of a shader ELF. Shaders are position independent, so the segments keep their
+	// distances from each other but are placed wherever the heap has room.
+	bool load_elf(const std::vector<unsigned char>& elf, shader_image& image)
+	{
 		Elf64_Ehdr header;
-		if (fread(&header, sizeof(header), 1, f) != 1) {
-			fclose(f);
-			std::fprintf(stderr, "%s: I/O failure (failed to read ELF header)\n", __func__);
-			return nullptr;
+		if (elf.size() < sizeof(header)) {
+			std::fprintf(stderr, "%s: File specified is not an ELF file.\n", __func__);
+			return false;
 		}
+		std::memcpy(&header, elf.data(), sizeof(header));
 		if (header.e_ident[0] != ELFMAG0 || header.e_ident[1] != ELFMAG1 
 		 || header.e_ident[2] != ELFMAG2 || header.e_ident[3] != ELFMAG3) {
-			fclose(f);
 			std::fprintf(stderr, "%s: File specified is not an ELF file.\n", __func__);
-			return nullptr;
-		 }
-
-		// Copy entire binary into shared memory
-		rewind(f);
-		size_t rs = fread(buffer + offset, 1, 0x500000, f);
-		if (!feof(f)) {
-			fclose(f);
-			std::fprintf(stderr, "%s: I/O failure (stream not EOF)\n", __func__);
-			return nullptr;
+			return false;
 		}
-		fclose(f);
+		if (header.e_ident[EI_CLASS] != ELFCLASS64 || header.e_machine != EM_RISCV
+		 || header.e_phentsize != sizeof(Elf64_Phdr)
+		 || header.e_phoff + header.e_phnum * sizeof(Elf64_Phdr) > elf.size()) {
+			std::fprintf(stderr, "%s: File specified is not a RV64 ELF file.\n", __func__);
+			return false;
+		}
+
+		// Find the extent of the loaded segments
+		std::vector<Elf64_Phdr> segments;
+		for (int i = 0; i < header.e_phnum; ++i) {
+			Elf64_Phdr segment;
+			std::memcpy(&segment, elf.data() + header.e_phoff + i * sizeof(Elf64_Phdr), sizeof(segment));
+			if (segment.p_type != PT_LOAD)
+				continue;
+			if (segment.p_filesz > segment.p_memsz || segment.p_offset + segment.p_filesz > elf.size()) {
+				std::fprintf(stderr, "%s: Segment %d is outside of the file.\n", __func__, i);
+				return false;
+			}
+			segments.push_back(segment);
+		}
+		if (segments.empty()) {
+			std::fprintf(stderr, "%s: ELF file has no loadable segments.\n", __func__);
+			return false;
+		}
+		uint64_t low = UINT64_MAX, high = 0;
+		for (const Elf64_Phdr& s : segments) {
+			low = std::min(low, s.p_vaddr);
+			high = std::max(high, s.p_vaddr + s.p_memsz);
+		}
+		low &= ~(SHADER_ALIGN - 1);
+
+		// Copy segments, everything not in the file (.bss and gaps) is zero
+		image.allocation = static_cast<unsigned char*>(allocate(high - low + SHADER_ALIGN - 1, PLUGIN_TAG_SHADER));
+		unsigned char* base = align_spike(image.allocation, SHADER_ALIGN);
+		std::memset(base, 0, high - low);
+		for (const Elf64_Phdr& s : segments)
+			std::memcpy(base + (s.p_vaddr - low), elf.data() + s.p_offset, s.p_filesz);
+		image.entry = base + (header.e_entry - low);
 #ifdef PLUGIN_DEBUG
-		std::printf("%s: Copied %zu bytes. e_entry = %lu\n", __func__, rs, header.e_entry);
+		std::printf("%s: Loaded %zu segments, %lu bytes. e_entry = %lu\n", __func__, segments.size(), high - low,
+		            header.e_entry);
 #endif
-		return buffer + offset + header.e_entry - 0x10000; // TODO: Try setting text segment to start at 0x0
+		return true;
 	}
 
-private:
-	// Transform the given struct from host to spike address space.
-	void structs_to_spike(program_t* & program)
+	// Drop a reference to a shader, which is freed with the last one.
+	void release_shader(uint64_t hash)
 	{
-		auto conv_addr_to_spike = [this](unsigned char* addr) -> unsigned char* 
-		{
-			if (addr)
-				addr = (addr - buffer) + reinterpret_cast<unsigned char*>(PLUGIN_BASE_ADDR);
-			return addr;
-		};
-
-		// uniforms can contain pointers, so we need to convert them as well.
-		blinn_uniforms_t* bup = (blinn_uniforms_t*) program->shader_uniforms;
-		if (bup) {
-			bup->joint_matrices = reinterpret_cast<mat4_t*>(conv_addr_to_spike(reinterpret_cast<unsigned char*>(bup->joint_matrices)));
-			bup->joint_n_matrices = reinterpret_cast<mat3_t*>(conv_addr_to_spike(reinterpret_cast<unsigned char*>(bup->joint_n_matrices)));
-			if (bup->shadow_map)
-				bup->shadow_map->buffer = reinterpret_cast<vec4_t*>(conv_addr_to_spike(reinterpret_cast<unsigned char*>(bup->shadow_map->buffer)));
-			bup->shadow_map = reinterpret_cast<texture_t*>(conv_addr_to_spike(reinterpret_cast<unsigned char*>(bup->shadow_map)));
-			if (bup->diffuse_map)
-				bup->diffuse_map->buffer = reinterpret_cast<vec4_t*>(conv_addr_to_spike(reinterpret_cast<unsigned char*>(bup->diffuse_map->buffer)));
-			bup->diffuse_map = reinterpret_cast<texture_t*>(conv_addr_to_spike(reinterpret_cast<unsigned char*>(bup->diffuse_map)));
-			if (bup->specular_map)
-				bup->specular_map->buffer = reinterpret_cast<vec4_t*>(conv_addr_to_spike(reinterpret_cast<unsigned char*>(bup->specular_map->buffer)));
-			bup->specular_map = reinterpret_cast<texture_t*>(conv_addr_to_spike(reinterpret_cast<unsigned char*>(bup->specular_map)));
-			if (bup->emission_map)
-				bup->emission_map->buffer = reinterpret_cast<vec4_t*>(conv_addr_to_spike(reinterpret_cast<unsigned char*>(bup->emission_map->buffer)));
-			bup->emission_map = reinterpret_cast<texture_t*>(conv_addr_to_spike(reinterpret_cast<unsigned char*>(bup->emission_map)));
-		}
-		bup = reinterpret_cast<blinn_uniforms_t*>(conv_addr_to_spike(reinterpret_cast<unsigned char*>(program->shader_uniforms)));
-
-		// program members
-		program->fragment_shader = reinterpret_cast<fragment_shader_t*>(conv_addr_to_spike(reinterpret_cast<unsigned char*>(program->fragment_shader)));
-		program->vertex_shader = reinterpret_cast<vertex_shader_t*>(conv_addr_to_spike(reinterpret_cast<unsigned char*>(program->vertex_shader)));
-		for (int i = 0; i < 3; ++i)
-			program->shader_attribs[i] = conv_addr_to_spike(reinterpret_cast<unsigned char*>(program->shader_attribs[i]));
-		program->shader_varyings = conv_addr_to_spike(reinterpret_cast<unsigned char*>(program->shader_varyings));
-		program->shader_uniforms = conv_addr_to_spike(reinterpret_cast<unsigned char*>(program->shader_uniforms));
-		for (int i = 0; i < MAX_VARYINGS; ++i) {
-			program->in_varyings[i] = conv_addr_to_spike(reinterpret_cast<unsigned char*>(program->in_varyings[i]));
-			program->out_varyings[i] = conv_addr_to_spike(reinterpret_cast<unsigned char*>(program->out_varyings[i]));
+		auto it = shader_cache.find(hash);
+		if (it != shader_cache.end() && --it->second.refs == 0) {
+			heap.deallocate(it->second.allocation);
+			shader_cache.erase(it);
 		}
+	}
 
-		// Lastly, convert the address of the struct itself.
-		program = reinterpret_cast<program_t*>(conv_addr_to_spike(reinterpret_cast<unsigned char*>(program)));
+	// First address at or after p that is aligned to align in the spike address space.
+	unsigned char* align_spike(unsigned char* p, uint64_t align) const
+	{
+		uint64_t addr = (p - buffer) + PLUGIN_BASE_ADDR;
+		return p + ((align - addr % align) % align);
 	}
 
-	// Transform the addresses in the given struct from the spike to the host address space.
-	void structs_to_host(program_t* & program)
+	// Convert an address in shared memory to the spike address space.
+	reg_t to_spike(const void* addr) const
 	{
-		auto conv_addr_to_host = [this](unsigned char* addr) -> unsigned char*
-		{
-			if (addr)
-				addr = (addr - reinterpret_cast<unsigned char*>(PLUGIN_BASE_ADDR)) + buffer;
-			return addr;
-		};
-
-		// First, convert the address of the struct itself.
-		program = reinterpret_cast<program_t*>(conv_addr_to_host(reinterpret_cast<unsigned char*>(program)));
-
-		// uniforms can contain pointers, so we need to convert them as well.
-		// blinn_uniforms_t* bup = (blinn_uniforms_t*) program->shader_uniforms;
-		blinn_uniforms_t* bup = reinterpret_cast<blinn_uniforms_t*>(conv_addr_to_host(reinterpret_cast<unsigned char*>(program->shader_uniforms)));
-		if (bup) {
-			bup->joint_matrices = reinterpret_cast<mat4_t*>(conv_addr_to_host(reinterpret_cast<unsigned char*>(bup->joint_matrices)));
-			bup->joint_n_matrices = reinterpret_cast<mat3_t*>(conv_addr_to_host(reinterpret_cast<unsigned char*>(bup->joint_n_matrices)));
-			bup->shadow_map = reinterpret_cast<texture_t*>(conv_addr_to_host(reinterpret_cast<unsigned char*>(bup->shadow_map)));
-			if (bup->shadow_map)
-				bup->shadow_map->buffer = reinterpret_cast<vec4_t*>(conv_addr_to_host(reinterpret_cast<unsigned char*>(bup->shadow_map->buffer)));
-			bup->diffuse_map = reinterpret_cast<texture_t*>(conv_addr_to_host(reinterpret_cast<unsigned char*>(bup->diffuse_map)));
-			if (bup->diffuse_map)
-				bup->diffuse_map->buffer = reinterpret_cast<vec4_t*>(conv_addr_to_host(reinterpret_cast<unsigned char*>(bup->diffuse_map->buffer)));
-			bup->specular_map = reinterpret_cast<texture_t*>(conv_addr_to_host(reinterpret_cast<unsigned char*>(bup->specular_map)));
-			if (bup->specular_map)
-				bup->specular_map->buffer = reinterpret_cast<vec4_t*>(conv_addr_to_host(reinterpret_cast<unsigned char*>(bup->specular_map->buffer)));
-			bup->emission_map = reinterpret_cast<texture_t*>(conv_addr_to_host(reinterpret_cast<unsigned char*>(bup->emission_map)));
-			if (bup->emission_map)
-				bup->emission_map->buffer = reinterpret_cast<vec4_t*>(conv_addr_to_host(reinterpret_cast<unsigned char*>(bup->emission_map->buffer)));
-		}
-
-		// program members
-		program->fragment_shader = reinterpret_cast<fragment_shader_t*>(conv_addr_to_host(reinterpret_cast<unsigned char*>(program->fragment_shader)));
-		program->vertex_shader = reinterpret_cast<vertex_shader_t*>(conv_addr_to_host(reinterpret_cast<unsigned char*>(program->vertex_shader)));
-		for (int i = 0; i < 3; ++i)
-			program->shader_attribs[i] = conv_addr_to_host(reinterpret_cast<unsigned char*>(program->shader_attribs[i]));
-		program->shader_varyings = conv_addr_to_host(reinterpret_cast<unsigned char*>(program->shader_varyings));
-		program->shader_uniforms = conv_addr_to_host(reinterpret_cast<unsigned char*>(program->shader_uniforms));
-		for (int i = 0; i < MAX_VARYINGS; ++i) {
-			program->in_varyings[i] = conv_addr_to_host(reinterpret_cast<unsigned char*>(program->in_varyings[i]));
-			program->out_varyings[i] = conv_addr_to_host(reinterpret_cast<unsigned char*>(program->out_varyings[i]));
+		const unsigned char* p = static_cast<const unsigned char*>(addr);
+		if (!p)
+			return 0;
+		if (p < buffer || p >= buffer + layout.size) {
+			std::fprintf(stderr, "%s: %p is not in shared memory\n", __func__, addr);
+			return 0;
+		}
+		return (p - buffer) + PLUGIN_BASE_ADDR;
+	}
+
+	// Spike address of the image of the given program, built if the uniforms were never committed.
+	reg_t spike_program_image(program_t* program)
+	{
+		program_image& image = program_images[program];
+		if (!image.current)
+			commit_uniforms(program);
+		program_slot& slot = *image.current;
+		if (guest_textures) {
+			residency_t* residency = reinterpret_cast<residency_t*>(slot.program + 1);
+			residency->epoch = ++last_epoch;
+			for (size_t i = 0; i < slot.textures.size(); ++i)
+				residency->textures[i].version = image_versions[slot.textures[i]];
+		}
+		batch_shaders_t* batch = PLUGIN_BATCH_SHADERS(slot.program);
+		batch->vertex = to_spike(image.vertex_batch);
+		batch->fragment = to_spike(image.fragment_batch);
+		return to_spike(slot.program);
+	}
+
+	// Copy obj to image, converting the pointers listed in layout to the spike address space.
+	void build_image(const void* obj, const layout_t* layout, unsigned char* image)
+	{
+		std::memcpy(image, obj, layout->size);
+		for (int i = 0; i < layout->num_relocs; ++i) {
+			const reloc_t& reloc = layout->relocs[i];
+			void* ptr;
+			std::memcpy(&ptr, static_cast<const unsigned char*>(obj) + reloc.offset, sizeof(ptr));
+			reg_t addr = reloc.target ? spike_image(ptr, reloc.target) : to_spike(ptr);
+			std::memcpy(image + reloc.offset, &addr, sizeof(addr));
+		}
+	}
+
+	// Spike address of the image of obj, which is built on first use.
+	reg_t spike_image(const void* obj, const layout_t* layout)
+	{
+		if (!obj)
+			return 0;
+		auto it = images.find(obj);
+		if (it == images.end()) {
+			unsigned char* image = static_cast<unsigned char*>(allocate(layout->size, PLUGIN_TAG_INTERNAL));
+			build_image(obj, layout, image);
+			it = images.emplace(obj, image).first;
+			invalidate(obj);
 		}
+		return to_spike(it->second);
 	}
+
 };
 
-void* plugin_malloc(size_t size)
+void* plugin_malloc(size_t size, plugin_tag_t tag)
 {
-	return fb_plugin->allocate(size);
+	return fb_plugin->allocate(size, tag);
 }
 
 void plugin_free(void* ptr)
@@ -296,11 +1101,81 @@ vec4_t plugin_fragment_shader(program_t *program, int *discard, int backface)
 	return fb_plugin->invoke_fragment_shader(program, discard, backface);
 }
 
+void plugin_post_fragment_shader_batch(program_t *program, framebuffer_t *framebuffer)
+{
+	fb_plugin->post_fragment_shader_batch(program, framebuffer);
+}
+
+void plugin_wait_fragment_shader_batch(void)
+{
+	fb_plugin->wait_fragment_shader_batch();
+}
+
+int plugin_guest_write(void)
+{
+	return fb_plugin->guest_write;
+}
+
+void plugin_invalidate(const void* obj)
+{
+	fb_plugin->invalidate(obj);
+}
+
+fs_ring_t* plugin_fragment_ring(int lane)
+{
+	return fb_plugin->fragment_ring(lane);
+}
+
+int plugin_num_lanes(void)
+{
+	return fb_plugin->num_lanes();
+}
+
+int plugin_vertex_stream_size(void)
+{
+	return fb_plugin->num_lanes() * PLUGIN_VS_STREAM_SIZE;
+}
+
 vec4_t plugin_vertex_shader(program_t *program, int i)
 {
 	return fb_plugin->invoke_vertex_shader(program, i);
 }
 
+vs_output_t* plugin_vertex_shader_batch(program_t *program, const void *attribs, int stride, int count)
+{
+	return fb_plugin->invoke_vertex_shader_batch(program, attribs, stride, count);
+}
+
+int plugin_guest_pipeline(void)
+{
+	return fb_plugin->guest_pipeline;
+}
+
+precision_t plugin_fs_precision(void)
+{
+	return fb_plugin->fs_precision;
+}
+
+const char* plugin_reference_dir(void)
+{
+	return fb_plugin->reference_dir.empty() ? nullptr : fb_plugin->reference_dir.c_str();
+}
+
+void plugin_draw_mesh(framebuffer_t *framebuffer, program_t *program, const void *vertices, int stride, int count)
+{
+	fb_plugin->invoke_draw_mesh(framebuffer, program, vertices, stride, count);
+}
+
+void plugin_set_uniform_layout(program_t *program, const layout_t *layout)
+{
+	fb_plugin->set_uniform_layout(program, layout);
+}
+
+void plugin_commit_uniforms(program_t *program)
+{
+	fb_plugin->commit_uniforms(program);
+}
+
 void plugin_update_fbaddr(unsigned char* addr)
 {
 	fb_plugin->invoke_update_fbaddr(addr);
@@ -311,9 +1186,40 @@ void plugin_draw(uint32_t pixel, ptrdiff_t offset)
 	fb_plugin->invoke_draw(pixel, offset);
 }
 
-void* plugin_set_shader(const char* file_name, char sdr_type)
+void* plugin_set_shader(program_t *program, const char* file_name, char sdr_type)
+{
+	return fb_plugin->load_shader(program, file_name, sdr_type);
+}
+
+void plugin_memory_report(void)
+{
+	fb_plugin->heap.report(stdout);
+}
+
+void plugin_end_frame(void)
+{
+	fb_plugin->end_frame();
+}
+
+void plugin_set_pass(const char* name)
+{
+	fb_plugin->set_pass(name);
+}
+
+const void* plugin_snapshot_find(const char* source, const char* kind, size_t* size)
+{
+	return fb_plugin->snapshot_find(source, kind, size);
+}
+
+void plugin_snapshot_add(const char* source, const char* kind, const void* header, size_t header_size,
+                         const void* payload, size_t payload_size)
+{
+	fb_plugin->snapshot_add(source, kind, header, header_size, payload, payload_size);
+}
+
+void plugin_snapshot_save(void)
 {
-	return fb_plugin->load_shader(file_name, sdr_type);
+	fb_plugin->snapshot_save();
 }
 
 void plugin_shutdown()
@@ -8,10 +8,61 @@ extern "C" {
 #include <stdlib.h>
 #endif
 
-/* Allocate memory in the MMIO plugin memory space. */
-void* plugin_malloc(size_t size);
+/* What an allocation is used for, usage is reported per tag. */
+typedef enum {
+    PLUGIN_TAG_OTHER,
+    PLUGIN_TAG_TEXTURE,
+    PLUGIN_TAG_FRAMEBUFFER,
+    PLUGIN_TAG_PROGRAM,
+    PLUGIN_TAG_MESH,
+    PLUGIN_TAG_SKELETON,
+    PLUGIN_TAG_SHADER,      /* loaded shader images */
+    PLUGIN_TAG_UNIFORMS,
+    PLUGIN_TAG_VARYINGS,    /* including the fragment rings and the vertex stream */
+    PLUGIN_TAG_INTERNAL,    /* rings and images owned by the plugin */
+    PLUGIN_NUM_TAGS
+} plugin_tag_t;
+
+/* Allocate memory in the MMIO plugin memory space.
+ * Aborts with a usage report if the memory space is exhausted. */
+void* plugin_malloc(size_t size, plugin_tag_t tag);
 void plugin_free(void* ptr);
 
+/* Tell spike that the contents of obj (e.g. the texels of a texture) changed,
+ * so that copies it keeps in its own memory are not used anymore. */
+void plugin_invalidate(const void* obj);
+
+/* Decoded assets (textures, meshes, ...) are kept in a snapshot file between
+ * runs with the plugin option snapshot=<file>.
+ * plugin_snapshot_find returns the data of the asset of the given kind (e.g.
+ * "mesh") decoded from source, if it was saved from the same contents of
+ * source, and NULL otherwise. The data stays valid until the plugin is
+ * destroyed. On a miss, the decoded asset can be added with
+ * plugin_snapshot_add as a header followed by a payload, which are copied
+ * only when a snapshot file is set, and plugin_snapshot_save writes the
+ * assets found or added so far. */
+const void* plugin_snapshot_find(const char* source, const char* kind, size_t* size);
+void plugin_snapshot_add(const char* source, const char* kind, const void* header, size_t header_size,
+                         const void* payload, size_t payload_size);
+void plugin_snapshot_save(void);
+
+/* Print live and high-water usage of the MMIO plugin memory space per tag. */
+void plugin_memory_report(void);
+
+/* Mark the end of a frame, prints the MMIO accesses of the frame if the
+ * plugin option profile=on is set and the cost of its shaders if costs=on
+ * is set. */
+void plugin_end_frame(void);
+
+/* Directory given with the plugin option reference=<dir>, NULL if none.
+ * Runs with precision=float save their first frames there, runs with another
+ * precision compare their frames with them. */
+const char* plugin_reference_dir(void);
+
+/* Name the pass (e.g. "shadow" or "main") the following draw calls belong
+ * to, shader costs are reported per pass and program. */
+void plugin_set_pass(const char* name);
+
 /* Signal to spike that it should terminate, so that the plugin can be deallocated. */
 void plugin_shutdown(void);
 
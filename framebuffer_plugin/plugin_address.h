@@ -3,81 +3,169 @@
 
 #include <stdint.h>
 #include <stdarg.h>
+#include "plugin_ring.h"
 
-#define PLUGIN_BASE_ADDR  0x10000000 /* Address of shared memory in spike address space. */
-#define PLUGIN_CMD_OFFSET 0x08b00000 /* Offset in shared memory where messages are sent. */
-#define PLUGIN_FS_OFFSET  0x08c00000 /* Offset in shared memory where fragment shader is loaded. */
-#define PLUGIN_VS_OFFSET  0x09100000 /* Offset in shared memory where vertex shader is loaded. */
+#define PLUGIN_BASE_ADDR     0x10000000 /* Address of shared memory in spike address space. */
+#define PLUGIN_MAX_MEM_SIZE  0x70000000 /* Largest shared memory that fits below DRAM (0x80000000). */
+
+#define PLUGIN_DEFAULT_MEM_SIZE    0x09600000 /* Size of shared memory, can be set with the size option. */
+#define PLUGIN_CMD_SIZE            0x00100000 /* Space for the control block and the mailboxes. */
+
+#define PLUGIN_MAGIC 0x4e4947554c504246ull /* "FBPLUGIN" */
+
+/* Header at offset 0 of shared memory, written once by the host before spike runs.
+ * It is followed by the allocations (including shader images) and then by the
+ * control block and the mailboxes at cmd_offset. */
+typedef struct {
+    uint64_t magic;                 /* PLUGIN_MAGIC */
+    uint64_t size;                  /* size of shared memory */
+    uint64_t cmd_offset;            /* offset of the control block, followed by the mailboxes */
+    uint64_t padding[5];
+} region_header_t;
 
 typedef uint64_t command_t;
 
 /* Command types */
 
-#define PLUGIN_CMD_VS       1 /* Run vertex shader on spike, 2 arguments (see plugin_vertex_shader). */
-#define PLUGIN_CMD_FS       2 /* Run fragment shader on spike, 3 arguments (see plugin_fragment_shader). */
+#define PLUGIN_CMD_VS       1 /* Run vertex shader on spike, 2 arguments (see plugin_vertex_shader).
+                               * Replies with 4 values, which form the return value of the vertex shader. */
+#define PLUGIN_CMD_FS       2 /* Run fragment shader on spike, 3 arguments (see plugin_fragment_shader).
+                               * Replies with 5 values, where the first is the value of discard and the rest
+                               * are the return value of the fragment shader. */
 #define PLUGIN_CMD_DRAW     4 /* Tell spike to store the given value on the given offset in the framebuffer, 2 arguments (see plugin_draw). */
 #define PLUGIN_CMD_FBADDR   8 /* Send framebuffer address to spike, 1 argument. */
 #define PLUGIN_CMD_STOP    16 /* Tell spike to terminate, 0 arguments. */
+#define PLUGIN_CMD_FS_BATCH 64 /* Run fragment shader on the jobs of a fragment ring from its tail up to a given head,
+                                * 4 arguments (program, framebuffer, ring, head). The host may queue jobs past head
+                                * while the command runs. Results are written to the result array of the ring, or straight
+                                * to the framebuffer if it is not NULL. */
+#define PLUGIN_CMD_VS_BATCH 128 /* Run vertex shader on a range of vertices, 5 arguments (program, address of first
+                                 * vertex, stride, number of vertices and output). Results are written to the output array. */
+#define PLUGIN_CMD_DRAW_MESH 256 /* Run the whole pipeline on a range of vertices, 5 arguments (program, address of first
+                                  * vertex, stride, number of vertices and framebuffer). Results are written to the framebuffer,
+                                  * every lane only rasterizes the tiles it owns (see PLUGIN_TILE_LANE). */
+
+/* Control block, written once by the host before any command is sent.
+ * Every spike process sees its own lane_base, the hart with id h of that
+ * process serves the mailbox of lane lane_base + h. */
+typedef struct {
+    volatile uint64_t num_lanes;    /* number of lanes over all spike processes */
+    volatile uint64_t num_harts;    /* number of harts of each spike process that take commands */
+    volatile uint64_t lane_base;    /* lane of hart 0 of this spike process */
+    volatile uint64_t costs;        /* nonzero if every lane reports the cost of its shaders (see lane_cost_t) */
+    uint64_t padding[4];
+} control_t;
+
+/* One mailbox per lane, each in its own cache line.
+ * The host only writes command, args and seq, spike only writes args and ack,
+ * so neither side can overwrite a value the other has not seen yet. */
+typedef struct {
+    volatile uint64_t seq;          /* incremented by the host after posting a command */
+    volatile uint64_t ack;          /* set to seq by spike when the command is done */
+    volatile uint64_t command;
+    volatile uint64_t args[5];      /* arguments, replaced by the reply values */
+} mailbox_t;
+
+/* Cost of the shaders run by the last command of a lane, measured with mcycle
+ * and minstret around every invocation and written by spike before it marks
+ * the command as done. Histograms count invocations by cycles, bucket i holds
+ * [2^i, 2^(i+1)) cycles and the last bucket everything above. */
+#define PLUGIN_COST_BUCKETS 24
 
-#define PLUGIN_CMD_READY   32 /* Signal that execution on spike is finished, variable number of arguments. 
-                               * After PLUGIN_CMD_VS: 4 arguments, which form the return value of the vertex shader.
-                               * After PLUGIN_CMD_FS: 5 arguments, where the first is the value of discard and the rest
-                               * are the return value of the fragment shader.
-                               * In any other case, no arguments are sent with this command.
-                               */
+typedef struct {
+    uint64_t invocations;
+    uint64_t cycles;
+    uint64_t instret;
+    uint64_t histogram[PLUGIN_COST_BUCKETS];
+} shader_cost_t;
 
+typedef struct {
+    shader_cost_t vertex;
+    shader_cost_t fragment;
+} lane_cost_t;
 
-/* Write a message to shared memory.
- * base_addr : address of shared memory
- * command   : command to send 
- * argc      : number of arguments to be written 
- * All arguments given are written after the command with 8-byte alignment. */
-static void send_msg(void* base_addr, command_t command, int argc, ...)
+#define PLUGIN_HEADER(base) ((volatile region_header_t*) (base))
+#define PLUGIN_CONTROL(base) ((control_t*) ((uint8_t*) (base) + PLUGIN_HEADER(base)->cmd_offset))
+#define PLUGIN_MAILBOX(base, lane) ((mailbox_t*) (PLUGIN_CONTROL(base) + 1) + (lane))
+#define PLUGIN_LANE_READY(base, lane) ((volatile uint64_t*) PLUGIN_MAILBOX(base, PLUGIN_MAX_LANES) + (lane))
+#define PLUGIN_MAILBOXES_SIZE (sizeof(control_t) + PLUGIN_MAX_LANES * (sizeof(mailbox_t) + sizeof(uint64_t)))
+#define PLUGIN_LANE_COST(base, lane) ((lane_cost_t*) PLUGIN_LANE_READY(base, PLUGIN_MAX_LANES) + (lane))
+#define PLUGIN_COSTS_SIZE (PLUGIN_MAX_LANES * sizeof(lane_cost_t))
+
+/* Value of the ready word of a lane (see PLUGIN_LANE_READY) once its hart takes
+ * commands. The host clears the ready words before spike runs and posts no
+ * command before every lane has announced itself. */
+#define PLUGIN_READY 0x59444145524246ull /* "FBREADY" */
+
+/* Announce that the hart serving lane waits for commands, called by spike
+ * once it has read the control block and its mailbox. */
+static inline void announce_ready(void* base, uint64_t lane)
+{
+    __sync_synchronize();
+    *PLUGIN_LANE_READY(base, lane) = PLUGIN_READY;
+}
+
+/* Nonzero if the hart serving lane has announced itself. */
+static inline int lane_ready(void* base, uint64_t lane)
 {
-    volatile uint64_t* cmd_addr = (uint64_t*) ((uint8_t*) base_addr + PLUGIN_CMD_OFFSET);
+    return *PLUGIN_LANE_READY(base, lane) == PLUGIN_READY;
+}
 
+/* Post a command to a mailbox, the previous command must be done.
+ * mailbox   : mailbox of the receiving lane
+ * command   : command to send
+ * argc      : number of arguments to be written (at most 5)
+ * All arguments given are written as 64-bit values. */
+static inline void send_msg(mailbox_t* mailbox, command_t command, int argc, ...)
+{
     va_list args;
     va_start(args, argc);
     for (int i = 0; i < argc; ++i)
-        cmd_addr[i + 1] = va_arg(args, uint64_t);
+        mailbox->args[i] = va_arg(args, uint64_t);
     va_end(args);
 
-    *cmd_addr = command;
+    mailbox->command = command;
+    __sync_synchronize();
+    mailbox->seq = mailbox->seq + 1;
 }
 
-/* Wait for a command and write the arguments received in the given buffer.
- * base_addr : address of shared memory
- * command   : binary or'd commands to wait for
- * args      : buffer to write arguments received into. Buffer length should be
- *             enough to hold the arguments for the command received. 
- *             If this is NULL, don't write arguments. */
-static command_t recv_msg(void* base_addr, command_t command, uint64_t* args)
+/* Wait for the next command in a mailbox and write its arguments in the given buffer.
+ * mailbox   : mailbox of this lane
+ * seen      : sequence number of the last command received, updated on return
+ * args      : buffer for 5 arguments. If this is NULL, don't write arguments. */
+static inline command_t recv_msg(mailbox_t* mailbox, uint64_t* seen, uint64_t* args)
 {
-    volatile uint64_t* cmd_addr = (uint64_t*) ((uint8_t*) base_addr + PLUGIN_CMD_OFFSET);
-    while (!(*cmd_addr & command)) { /* wait until command is returned */ }
+    while (mailbox->seq == *seen) { /* wait until a command is posted */ }
+    __sync_synchronize();
+    *seen = mailbox->seq;
 
     if (args) {
-        int argc = 0;
-        switch (*cmd_addr) {
-        case PLUGIN_CMD_FBADDR:
-            argc = 1;
-            break;
-        case PLUGIN_CMD_DRAW:
-        case PLUGIN_CMD_VS:
-            argc = 2;
-            break;
-        case PLUGIN_CMD_FS:
-            argc = 3;
-            break;
-        case PLUGIN_CMD_READY:
-            argc = 5;
-            break;
-        }
-        for (int i = 0; i < argc; ++i)
-            args[i] = cmd_addr[i + 1];
+        for (int i = 0; i < 5; ++i)
+            args[i] = mailbox->args[i];
     }
+    return mailbox->command;
+}
 
-    return *cmd_addr;
+/* Mark the last command received as done.
+ * mailbox   : mailbox of this lane
+ * seen      : sequence number of the command
+ * argc      : number of reply values to be written (at most 5) */
+static inline void reply_msg(mailbox_t* mailbox, uint64_t seen, int argc, ...)
+{
+    va_list args;
+    va_start(args, argc);
+    for (int i = 0; i < argc; ++i)
+        mailbox->args[i] = va_arg(args, uint64_t);
+    va_end(args);
+
+    __sync_synchronize();
+    mailbox->ack = seen;
+}
+
+/* Nonzero if the last command posted to the mailbox is done. */
+static inline int msg_done(const mailbox_t* mailbox)
+{
+    return mailbox->ack == mailbox->seq;
 }
 
 #endif /* _PLUGIN_ADDRESS_H */
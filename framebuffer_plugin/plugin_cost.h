@@ -0,0 +1,105 @@
+#ifndef _PLUGIN_COST_H
+#define _PLUGIN_COST_H
+
+#include "plugin_address.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <utility>
+
+// Adds up the cost of the shaders reported by spike (see lane_cost_t) per pass
+// and program. Every model has its own program, so this is also the cost per
+// model. Prints what ran in every frame and, on shutdown, the totals with
+// histograms of the cycles per invocation.
+class shader_cost_profiler
+{
+public:
+	void set_pass(const char* name)
+	{
+		pass = name;
+	}
+
+	// Add the cost of a command run for program, name is used the first time the program is seen in this pass.
+	void add(const void* program, const std::string& name, const lane_cost_t& cost)
+	{
+		entry& e = entries[std::make_pair(pass, program)];
+		if (e.name.empty())
+			e.name = name;
+		for (shader_cost_t* total : {&e.vertex, &e.frame_vertex})
+			add(*total, cost.vertex);
+		for (shader_cost_t* total : {&e.fragment, &e.frame_fragment})
+			add(*total, cost.fragment);
+	}
+
+	// Print the cost of the shaders run since the previous frame.
+	void end_frame(std::FILE* out)
+	{
+		std::fprintf(out, "shader cost frame %lu:\n", ++frames);
+		for (auto& it : entries) {
+			entry& e = it.second;
+			if (e.frame_vertex.invocations || e.frame_fragment.invocations)
+				print(out, it.first.first, e.name, e.frame_vertex, e.frame_fragment);
+			e.frame_vertex = shader_cost_t{};
+			e.frame_fragment = shader_cost_t{};
+		}
+	}
+
+	// Print the cost of the shaders run since the start.
+	void report(std::FILE* out) const
+	{
+		std::fprintf(out, "shader cost over %lu frames:\n", frames);
+		for (auto& it : entries) {
+			const entry& e = it.second;
+			print(out, it.first.first, e.name, e.vertex, e.fragment);
+			print_histogram(out, "vs", e.vertex);
+			print_histogram(out, "fs", e.fragment);
+		}
+	}
+
+private:
+	struct entry
+	{
+		std::string name;
+		shader_cost_t vertex = {};
+		shader_cost_t fragment = {};
+		shader_cost_t frame_vertex = {};
+		shader_cost_t frame_fragment = {};
+	};
+
+	static void add(shader_cost_t& total, const shader_cost_t& cost)
+	{
+		total.invocations += cost.invocations;
+		total.cycles += cost.cycles;
+		total.instret += cost.instret;
+		for (int i = 0; i < PLUGIN_COST_BUCKETS; ++i)
+			total.histogram[i] += cost.histogram[i];
+	}
+
+	static void print(std::FILE* out, const std::string& pass, const std::string& name, const shader_cost_t& vertex,
+	                  const shader_cost_t& fragment)
+	{
+		std::fprintf(out, "  %-8s %-40s vs: %10lu calls %14lu cycles %14lu instret, fs: %10lu calls %14lu cycles "
+		             "%14lu instret\n", pass.c_str(), name.c_str(), vertex.invocations, vertex.cycles, vertex.instret,
+		             fragment.invocations, fragment.cycles, fragment.instret);
+	}
+
+	static void print_histogram(std::FILE* out, const char* type, const shader_cost_t& cost)
+	{
+		if (!cost.invocations)
+			return;
+		std::fprintf(out, "    %s cycles per call:", type);
+		for (int i = 0; i < PLUGIN_COST_BUCKETS; ++i) {
+			if (cost.histogram[i])
+				std::fprintf(out, " %s2^%d:%lu", i == PLUGIN_COST_BUCKETS - 1 ? ">=" : "", i, cost.histogram[i]);
+		}
+		std::fprintf(out, "\n");
+	}
+
+	std::string pass = "main";
+	std::map<std::pair<std::string, const void*>, entry> entries;
+	unsigned long frames = 0;
+};
+
+#endif /* _PLUGIN_COST_H */
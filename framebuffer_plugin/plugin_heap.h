@@ -0,0 +1,171 @@
+#ifndef _PLUGIN_HEAP_H
+#define _PLUGIN_HEAP_H
+
+#include "fbplugin.h"
+
+#include <cstddef>
+#include <cstdio>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+// Allocator for a fixed region of shared memory. Small blocks are rounded up to
+// a power of two and recycled through one free list per size class. Large blocks
+// are rounded up to whole pages and taken first-fit from a free map, where
+// neighbouring blocks are merged. Nothing is ever placed past the end of the
+// region. Every block has a tag, and live and high-water usage is kept per tag.
+class plugin_heap
+{
+public:
+	static const size_t MIN_BLOCK = 16;          // Smallest block, also the alignment of every block.
+	static const size_t MAX_SMALL_BLOCK = 65536; // Largest block with a size class.
+	static const size_t PAGE = 4096;             // Granularity of large blocks.
+
+	plugin_heap(unsigned char* base, size_t limit) : base(base), limit(limit) {}
+
+	// Returns nullptr if the region is exhausted.
+	void* allocate(size_t size, plugin_tag_t tag)
+	{
+		size_t block_size = round_size(size);
+		int size_class = class_of(block_size);
+		size_t offset;
+
+		if (size_class >= 0 && !free_lists[size_class].empty()) {
+			offset = free_lists[size_class].back();
+			free_lists[size_class].pop_back();
+		} else if (size_class >= 0 || !take_large(block_size, &offset)) {
+			if (limit - top < block_size)
+				return nullptr;
+			offset = top;
+			top += block_size;
+			if (top > top_high_water)
+				top_high_water = top;
+		}
+
+		blocks[offset] = block{block_size, tag};
+		usage& u = tags[tag];
+		u.live += block_size;
+		u.blocks += 1;
+		if (u.live > u.high_water)
+			u.high_water = u.live;
+		return base + offset;
+	}
+
+	// Returns the size of the block, or 0 if ptr is not a live block.
+	size_t deallocate(void* ptr)
+	{
+		unsigned char* p = static_cast<unsigned char*>(ptr);
+		if (p < base || p >= base + limit)
+			return 0;
+		auto it = blocks.find(p - base);
+		if (it == blocks.end())
+			return 0;
+
+		size_t offset = it->first;
+		block b = it->second;
+		blocks.erase(it);
+		tags[b.tag].live -= b.size;
+		tags[b.tag].blocks -= 1;
+
+		int size_class = class_of(b.size);
+		if (size_class >= 0)
+			free_lists[size_class].push_back(offset);
+		else
+			give_back_large(offset, b.size);
+		return b.size;
+	}
+
+	void report(std::FILE* out) const
+	{
+		static const char* names[PLUGIN_NUM_TAGS] = {
+			"other", "texture", "framebuffer", "program", "mesh", "skeleton", "shader", "uniforms", "varyings",
+			"internal"
+		};
+		std::fprintf(out, "shared memory usage (limit %zu bytes, high-water %zu bytes):\n", limit, top_high_water);
+		for (int t = 0; t < PLUGIN_NUM_TAGS; ++t)
+			std::fprintf(out, "  %-11s: %12zu bytes live in %7zu blocks, %12zu bytes high-water\n",
+			             names[t], tags[t].live, tags[t].blocks, tags[t].high_water);
+	}
+
+private:
+	struct block
+	{
+		size_t size;
+		plugin_tag_t tag;
+	};
+
+	struct usage
+	{
+		size_t live = 0;
+		size_t blocks = 0;
+		size_t high_water = 0;
+	};
+
+	static const int NUM_CLASSES = 13; // 16 bytes to MAX_SMALL_BLOCK
+
+	static size_t round_size(size_t size)
+	{
+		if (size > MAX_SMALL_BLOCK)
+			return (size + PAGE - 1) / PAGE * PAGE;
+		size_t block_size = MIN_BLOCK;
+		while (block_size < size)
+			block_size *= 2;
+		return block_size;
+	}
+
+	// Size class of a rounded size, or -1 for large blocks.
+	static int class_of(size_t block_size)
+	{
+		if (block_size > MAX_SMALL_BLOCK)
+			return -1;
+		int size_class = 0;
+		while ((MIN_BLOCK << size_class) < block_size)
+			++size_class;
+		return size_class;
+	}
+
+	bool take_large(size_t size, size_t* offset)
+	{
+		for (auto it = free_large.begin(); it != free_large.end(); ++it) {
+			if (it->second < size)
+				continue;
+			*offset = it->first;
+			size_t rest = it->second - size;
+			free_large.erase(it);
+			if (rest)
+				free_large[*offset + size] = rest;
+			return true;
+		}
+		return false;
+	}
+
+	void give_back_large(size_t offset, size_t size)
+	{
+		auto next = free_large.find(offset + size);
+		if (next != free_large.end()) {
+			size += next->second;
+			free_large.erase(next);
+		}
+		auto prev = free_large.lower_bound(offset);
+		if (prev != free_large.begin() && (--prev)->first + prev->second == offset) {
+			offset = prev->first;
+			size += prev->second;
+			free_large.erase(prev);
+		}
+		if (offset + size == top)
+			top = offset;
+		else
+			free_large[offset] = size;
+	}
+
+	unsigned char* base;
+	size_t limit;
+	size_t top = 0;            // Everything from here to limit is unused.
+	size_t top_high_water = 0;
+	std::unordered_map<size_t, block> blocks;  // Live blocks by offset.
+	std::vector<size_t> free_lists[NUM_CLASSES];
+	std::map<size_t, size_t> free_large;       // Free large blocks, offset to size.
+	usage tags[PLUGIN_NUM_TAGS];
+};
+
+#endif /* _PLUGIN_HEAP_H */
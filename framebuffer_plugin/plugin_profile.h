@@ -0,0 +1,142 @@
+#ifndef _PLUGIN_PROFILE_H
+#define _PLUGIN_PROFILE_H
+
+#include "fbplugin.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+// Counts the loads and stores spike makes to shared memory, by the region they
+// hit. Regions are the allocation tags plus the header, the mailboxes and
+// unallocated memory, looked up in a map with one entry per GRANULE bytes (so a
+// small block sharing a granule with another one may be counted as its
+// neighbour). Counters are updated by spike and read by the renderer at the end
+// of every frame, which prints what changed since the previous frame.
+class mmio_profiler
+{
+public:
+	enum { HEADER = PLUGIN_NUM_TAGS, MAILBOX, UNALLOCATED, NUM_REGIONS };
+	enum { LOAD, STORE, NUM_KINDS };
+	enum { SIZE_1, SIZE_2, SIZE_4, SIZE_8, SIZE_OTHER, NUM_SIZES };
+	static const size_t GRANULE = 64;
+
+	bool enabled() const
+	{
+		return !regions.empty();
+	}
+
+	void enable(size_t size)
+	{
+		regions.assign((size + GRANULE - 1) / GRANULE, UNALLOCATED);
+	}
+
+	// Set the region of [offset, offset + len).
+	void mark(size_t offset, size_t len, int region)
+	{
+		if (!enabled() || len == 0)
+			return;
+		size_t first = offset / GRANULE;
+		size_t last = std::min((offset + len - 1) / GRANULE, regions.size() - 1);
+		std::memset(&regions[first], region, last - first + 1);
+	}
+
+	void record(size_t offset, size_t len, int kind)
+	{
+		counter& c = counters[regions[offset / GRANULE]][kind];
+		c.count.fetch_add(1, std::memory_order_relaxed);
+		c.bytes.fetch_add(len, std::memory_order_relaxed);
+		c.sizes[size_bucket(len)].fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// Print the accesses since the previous frame.
+	void end_frame(std::FILE* out)
+	{
+		snapshot now = take_snapshot();
+		std::fprintf(out, "mmio frame %lu:\n", ++frames);
+		print(out, now, &last);
+		last = now;
+	}
+
+	// Print the accesses since the start.
+	void report(std::FILE* out)
+	{
+		std::fprintf(out, "mmio accesses over %lu frames:\n", frames);
+		print(out, take_snapshot(), nullptr);
+	}
+
+private:
+	struct counter
+	{
+		std::atomic<uint64_t> count{0};
+		std::atomic<uint64_t> bytes{0};
+		std::atomic<uint64_t> sizes[NUM_SIZES] = {};
+	};
+
+	struct snapshot
+	{
+		uint64_t count[NUM_REGIONS][NUM_KINDS] = {};
+		uint64_t bytes[NUM_REGIONS][NUM_KINDS] = {};
+		uint64_t sizes[NUM_REGIONS][NUM_KINDS][NUM_SIZES] = {};
+	};
+
+	static int size_bucket(size_t len)
+	{
+		switch (len) {
+		case 1: return SIZE_1;
+		case 2: return SIZE_2;
+		case 4: return SIZE_4;
+		case 8: return SIZE_8;
+		default: return SIZE_OTHER;
+		}
+	}
+
+	snapshot take_snapshot() const
+	{
+		snapshot s;
+		for (int r = 0; r < NUM_REGIONS; ++r) {
+			for (int k = 0; k < NUM_KINDS; ++k) {
+				s.count[r][k] = counters[r][k].count.load(std::memory_order_relaxed);
+				s.bytes[r][k] = counters[r][k].bytes.load(std::memory_order_relaxed);
+				for (int i = 0; i < NUM_SIZES; ++i)
+					s.sizes[r][k][i] = counters[r][k].sizes[i].load(std::memory_order_relaxed);
+			}
+		}
+		return s;
+	}
+
+	// Print the regions that were accessed, relative to base if it is not null.
+	static void print(std::FILE* out, const snapshot& s, const snapshot* base)
+	{
+		static const char* names[NUM_REGIONS] = {
+			"other", "texture", "framebuffer", "program", "mesh", "skeleton", "shader", "uniforms", "varyings",
+			"internal", "header", "mailbox", "unallocated"
+		};
+		static const char* kinds[NUM_KINDS] = {"load", "store"};
+		for (int r = 0; r < NUM_REGIONS; ++r) {
+			for (int k = 0; k < NUM_KINDS; ++k) {
+				uint64_t count = s.count[r][k] - (base ? base->count[r][k] : 0);
+				if (count == 0)
+					continue;
+				uint64_t bytes = s.bytes[r][k] - (base ? base->bytes[r][k] : 0);
+				uint64_t sizes[NUM_SIZES];
+				for (int i = 0; i < NUM_SIZES; ++i)
+					sizes[i] = s.sizes[r][k][i] - (base ? base->sizes[r][k][i] : 0);
+				std::fprintf(out, "  %-11s %-5s: %12lu accesses, %14lu bytes, size 1/2/4/8/other: %lu/%lu/%lu/%lu/%lu\n",
+				             names[r], kinds[k], count, bytes, sizes[SIZE_1], sizes[SIZE_2], sizes[SIZE_4],
+				             sizes[SIZE_8], sizes[SIZE_OTHER]);
+			}
+		}
+	}
+
+	std::vector<uint8_t> regions; // Region of every granule, empty when profiling is off.
+	counter counters[NUM_REGIONS][NUM_KINDS];
+	snapshot last;
+	unsigned long frames = 0;
+};
+
+#endif /* _PLUGIN_PROFILE_H */
@@ -0,0 +1,98 @@
+#ifndef _PLUGIN_RING_H
+#define _PLUGIN_RING_H
+
+#include <stdint.h>
+
+/* Layout of the work queues shared between the host and spike.
+ * Both sides run on LP64 targets, so the layout is identical. */
+
+#define PLUGIN_FS_RING_SIZE        2048 /* Number of fragment jobs in the ring, must be a power of two. */
+#define PLUGIN_VS_STREAM_SIZE      3072 /* Number of vertices in the vertex output stream, must be a multiple of 3. */
+#define PLUGIN_MAX_VARYING_FLOATS  24   /* Largest varyings struct (in floats) that fits in a job. */
+#define PLUGIN_MAX_HARTS           8    /* Largest number of harts per spike process, see start.S and ls.ld. */
+#define PLUGIN_MAX_LANES           64   /* Largest number of harts taking commands over all spike processes. */
+
+/* A lane is one hart of one spike process, numbered over all processes.
+ * Tiles of the framebuffer are interleaved between lanes so that every pixel
+ * is always shaded and written by the same lane, which keeps blending in
+ * submission order without any locking. */
+#define PLUGIN_TILE_SHIFT 5
+#define PLUGIN_TILE_LANE(x, y, num_lanes) \
+    ((((x) >> PLUGIN_TILE_SHIFT) + ((y) >> PLUGIN_TILE_SHIFT)) % (num_lanes))
+
+/* Fragment job ring, one per lane.
+ * The host is the only producer (advances head), spike is the only consumer
+ * (advances tail). */
+
+typedef struct {
+    int32_t index;      /* pixel index in the framebuffer */
+    int32_t backface;   /* backface flag passed to the fragment shader */
+    float depth;        /* interpolated depth of the fragment */
+    int32_t padding;
+    float varyings[PLUGIN_MAX_VARYING_FLOATS]; /* interpolated varyings */
+} fs_job_t;
+
+typedef struct {
+    int32_t discard;    /* value of discard after running the fragment shader */
+    float color[4];     /* return value of the fragment shader */
+} fs_result_t;
+
+typedef struct {
+    uint64_t head;      /* next slot to be written by the host */
+    uint64_t tail;      /* next slot to be shaded by spike */
+    fs_job_t jobs[PLUGIN_FS_RING_SIZE];
+    fs_result_t results[PLUGIN_FS_RING_SIZE];
+} fs_ring_t;
+
+#define PLUGIN_FS_RING_SLOT(i) ((i) & (PLUGIN_FS_RING_SIZE - 1))
+
+/* Vertex output stream.
+ * Element i holds the output of the vertex shader for the i-th vertex of the
+ * range given with the last PLUGIN_CMD_VS_BATCH. The host splits the range
+ * between lanes, each lane writes its part of the stream. */
+
+typedef struct {
+    float coord[4];     /* clip coordinates returned by the vertex shader */
+    float varyings[PLUGIN_MAX_VARYING_FLOATS]; /* varyings written by the vertex shader */
+} vs_output_t;
+
+/* Residency list of a program, right after its image (program_t) in shared
+ * memory. It lists the textures referenced directly from the uniforms, which
+ * spike copies to its own memory (plugin option textures=guest) so that
+ * sampling does not go through the MMIO plugin. The host rewrites epoch and
+ * the versions before every command naming the program. */
+
+#define PLUGIN_MAX_RESIDENT_TEXTURES 16
+
+typedef struct {
+    uint64_t offset;    /* offset of the texture pointer in the uniforms */
+    uint64_t version;   /* changes whenever the texels (or the texture at that address) change */
+} resident_texture_t;
+
+typedef struct {
+    uint64_t epoch;             /* number of the command, increases with every command */
+    uint64_t generation;        /* changes whenever the uniforms are committed */
+    uint64_t sizeof_uniforms;   /* 0 if the uniforms and textures stay in shared memory */
+    uint64_t num_textures;
+    resident_texture_t textures[PLUGIN_MAX_RESIDENT_TEXTURES];
+} residency_t;
+
+/* Batch shaders of a program, right after its residency list. These are
+ * optional versions of its shaders that run on a whole range of work per call
+ * (plugin option vector=on, see spike/shaders/vertAV.c), spike uses the
+ * scalar shaders when they are 0. The host rewrites them before every command
+ * naming the program. */
+
+typedef void vertex_batch_shader_t(const void *attribs, uint64_t stride, uint64_t count,
+                                   vs_output_t *outputs, void *uniforms);
+typedef void fragment_batch_shader_t(const fs_job_t *jobs, fs_result_t *results, uint64_t count,
+                                     void *uniforms);
+
+typedef struct {
+    uint64_t vertex;    /* vertex_batch_shader_t in the spike address space, 0 if none */
+    uint64_t fragment;  /* fragment_batch_shader_t in the spike address space, 0 if none */
+} batch_shaders_t;
+
+#define PLUGIN_BATCH_SHADERS(program) ((batch_shaders_t*) ((residency_t*) ((program) + 1) + 1))
+
+#endif /* _PLUGIN_RING_H */
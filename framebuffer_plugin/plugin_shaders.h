@@ -12,24 +12,88 @@ extern "C" {
 #include <stddef.h>
 #endif
 #include "../renderer/renderer/core/graphics.h"
+#include "plugin_ring.h"
 
 /* Run fragment shader on spike. */
 vec4_t plugin_fragment_shader(program_t *program, int *discard, int backface);
 
+/* Start running fragment shader on spike for every job queued in the fragment
+ * rings, up to their current head. If framebuffer is not NULL, spike repeats
+ * the depth test and writes the surviving fragments (color and depth) to it,
+ * otherwise the results are written to the rings.
+ * Returns at once, more jobs can be queued while the batch runs as long as
+ * the slots of the batch are not overwritten. The previous batch must be
+ * done. */
+void plugin_post_fragment_shader_batch(program_t *program, framebuffer_t *framebuffer);
+
+/* Wait until spike has consumed the batch posted last, the tail of every ring
+ * is then at the head it had when the batch was posted. */
+void plugin_wait_fragment_shader_batch(void);
+
+/* Nonzero if fragments are written to the framebuffer by spike (plugin option write=guest). */
+int plugin_guest_write(void);
+
+/* Number of lanes (harts of all spike processes) that take commands. */
+int plugin_num_lanes(void);
+
+/* Get the fragment ring of the given lane in host address space.
+ * Fragments of a pixel must always be queued in the ring of the lane that
+ * owns its tile (see PLUGIN_TILE_LANE). */
+fs_ring_t* plugin_fragment_ring(int lane);
+
 /* Run vertex shader on spike. */
 vec4_t plugin_vertex_shader(program_t *program, int i);
 
+/* Number of vertices that fit in the vertex output stream. */
+int plugin_vertex_stream_size(void);
+
+/* Run vertex shader on spike for a range of vertices, split between all lanes.
+ * attribs : first vertex, must be in shared memory
+ * stride  : distance in bytes between consecutive vertices
+ * count   : number of vertices, at most plugin_vertex_stream_size()
+ * Returns the vertex output stream in host address space. */
+vs_output_t* plugin_vertex_shader_batch(program_t *program, const void *attribs, int stride, int count);
+
+/* Nonzero if draw calls run entirely on spike (plugin option pipeline=guest). */
+int plugin_guest_pipeline(void);
+
+/* Precision of the fragment shaders (plugin option precision), programs that
+ * have a shader of that precision load it with spike_set_fs_precision.
+ * Always PRECISION_FLOAT with pipeline=guest. */
+precision_t plugin_fs_precision(void);
+
+/* Run the whole pipeline on spike for a range of vertices, every three vertices
+ * form a triangle.
+ * vertices : first vertex, must be in shared memory
+ * stride   : distance in bytes between consecutive vertices
+ * count    : number of vertices
+ * Returns after the triangles have been written to the framebuffer. */
+void plugin_draw_mesh(framebuffer_t *framebuffer, program_t *program, const void *vertices, int stride, int count);
+
+/* Set the layout of the uniforms of the given program, NULL if they contain
+ * no pointers. */
+void plugin_set_uniform_layout(program_t *program, const layout_t *layout);
+
+/* Copy the uniforms of the given program to the spike address space.
+ * Must be called after the uniforms changed and before the next draw. */
+void plugin_commit_uniforms(program_t *program);
+
 /* Update the framebuffer address in spike. */
 void plugin_update_fbaddr(unsigned char* addr);
 /* Draw the given pixel in the specified offset from the framebuffer. */
 void plugin_draw(uint32_t pixel, ptrdiff_t offset);
 
-/* Set the fragment shader.
- * file_name : File name of shader.
- * sdr_type : Fragment shader if 0, else vertex shader.
+/* Load a shader for a program, replacing the one it had of the same type.
+ * Shaders of every program stay resident until replaced or until the program
+ * is freed.
+ * program   : Program the shader belongs to.
+ * file_name : File name of shader, a position independent RISC-V ELF.
+ * sdr_type  : Fragment shader if 0, vertex shader if 1, batch fragment shader
+ *             if 2 and batch vertex shader if 3 (see batch_shaders_t).
  * Returns the entry point to the shader in shared memory or NULL if
- * loading failed. */
-void* plugin_set_shader(const char* file_name, char sdr_type);
+ * loading failed. Batch shaders are only loaded with the plugin option
+ * vector=on. */
+void* plugin_set_shader(program_t *program, const char* file_name, char sdr_type);
 
 #ifdef __cplusplus
 }
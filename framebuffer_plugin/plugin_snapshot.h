@@ -0,0 +1,175 @@
+#ifndef _PLUGIN_SNAPSHOT_H
+#define _PLUGIN_SNAPSHOT_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// File of decoded assets (texels of textures, vertices of meshes, ...) by key,
+// each with the hash of the file it was decoded from. The file is mapped when
+// the plugin starts, so an asset whose source did not change is copied
+// straight from it instead of being decoded again. Holds no pointers.
+//
+// Layout: SNAPSHOT_MAGIC, then one record per asset: key size, source hash
+// and data size (uint64_t each), the key and the data, both padded to
+// RECORD_ALIGN bytes.
+class plugin_snapshot
+{
+public:
+	static constexpr uint64_t SNAPSHOT_MAGIC = 0x31304e5041534246ull; // "FBSNAP01"
+	static constexpr size_t RECORD_ALIGN = 16;
+
+	~plugin_snapshot()
+	{
+		if (mapping)
+			munmap(mapping, mapping_size);
+	}
+
+	bool enabled() const
+	{
+		return !path.empty();
+	}
+
+	// Map the snapshot at file_name if there is one, assets added later are saved there.
+	void open(const std::string& file_name)
+	{
+		path = file_name;
+		int fd = ::open(path.c_str(), O_RDONLY);
+		struct stat st = {};
+		if (fd < 0 || fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(uint64_t)) {
+			if (fd >= 0)
+				close(fd);
+			return;
+		}
+		void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (addr == MAP_FAILED)
+			return;
+		mapping = static_cast<unsigned char*>(addr);
+		mapping_size = st.st_size;
+
+		uint64_t magic;
+		std::memcpy(&magic, mapping, sizeof(magic));
+		if (magic != SNAPSHOT_MAGIC) {
+			std::fprintf(stderr, "%s: %s is not a snapshot, ignored\n", __func__, path.c_str());
+			return;
+		}
+		size_t offset = RECORD_ALIGN;
+		while (offset + 3 * sizeof(uint64_t) <= mapping_size) {
+			uint64_t fields[3];
+			std::memcpy(fields, mapping + offset, sizeof(fields));
+			size_t key_offset = offset + pad(sizeof(fields));
+			size_t data_offset = key_offset + pad(fields[0]);
+			if (fields[0] > mapping_size || fields[2] > mapping_size || data_offset + fields[2] > mapping_size)
+				break; // truncated
+			entry& e = entries[std::string(reinterpret_cast<const char*>(mapping + key_offset), fields[0])];
+			e.hash = fields[1];
+			e.data = mapping + data_offset;
+			e.size = fields[2];
+			offset = data_offset + pad(fields[2]);
+		}
+		std::printf("snapshot: %zu assets in %s\n", entries.size(), path.c_str());
+	}
+
+	// Data of key if it was decoded from a source with the given hash, nullptr otherwise.
+	const void* find(const std::string& key, uint64_t hash, size_t* size)
+	{
+		auto it = entries.find(key);
+		if (it == entries.end() || it->second.hash != hash)
+			return nullptr;
+		it->second.used = true;
+		*size = it->second.size;
+		return it->second.data;
+	}
+
+	// Add the asset made of header followed by payload, both copied once into the entry.
+	void add(const std::string& key, uint64_t hash, const void* header, size_t header_size, const void* payload,
+	         size_t payload_size)
+	{
+		entry& e = entries[key];
+		const unsigned char* head = static_cast<const unsigned char*>(header);
+		const unsigned char* body = static_cast<const unsigned char*>(payload);
+		e.copy.reserve(header_size + payload_size);
+		e.copy.assign(head, head + header_size);
+		e.copy.insert(e.copy.end(), body, body + payload_size);
+		e.hash = hash;
+		e.data = e.copy.data();
+		e.size = e.copy.size();
+		e.used = true;
+		dirty = true;
+	}
+
+	// Write the assets used since the start (found or added) if anything changed, dropping the others.
+	void save()
+	{
+		for (auto& it : entries)
+			dirty |= !it.second.used;
+		if (!enabled() || !dirty)
+			return;
+		std::string temp = path + ".tmp";
+		FILE* f = std::fopen(temp.c_str(), "wb");
+		if (!f) {
+			std::perror("framebuffer_plugin: cannot write snapshot");
+			return;
+		}
+		size_t count = 0;
+		bool ok = write_padded(f, &SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+		for (auto& it : entries) {
+			if (!ok)
+				break;
+			if (!it.second.used)
+				continue;
+			uint64_t fields[3] = {it.first.size(), it.second.hash, it.second.size};
+			ok = write_padded(f, fields, sizeof(fields)) && write_padded(f, it.first.data(), it.first.size())
+			  && write_padded(f, it.second.data, it.second.size);
+			++count;
+		}
+		// A short write (e.g. a full disk) must not replace the previous snapshot.
+		ok = ok && !std::ferror(f);
+		ok = std::fclose(f) == 0 && ok;
+		if (!ok || std::rename(temp.c_str(), path.c_str()) != 0) {
+			std::perror("framebuffer_plugin: cannot write snapshot");
+			std::remove(temp.c_str());
+			return;
+		}
+		dirty = false;
+		std::printf("snapshot: saved %zu assets to %s\n", count, path.c_str());
+	}
+
+private:
+	struct entry
+	{
+		uint64_t hash = 0;
+		const unsigned char* data = nullptr; // In the mapping or in copy.
+		size_t size = 0;
+		bool used = false;                   // Found or added since the start, so worth saving.
+		std::vector<unsigned char> copy;     // Data of assets added since the start.
+	};
+
+	static size_t pad(size_t size)
+	{
+		return (size + RECORD_ALIGN - 1) / RECORD_ALIGN * RECORD_ALIGN;
+	}
+
+	static bool write_padded(FILE* f, const void* data, size_t size)
+	{
+		static const unsigned char zeros[RECORD_ALIGN] = {};
+		size_t padding = pad(size) - size;
+		return std::fwrite(data, 1, size, f) == size && std::fwrite(zeros, 1, padding, f) == padding;
+	}
+
+	std::string path;
+	unsigned char* mapping = nullptr;
+	size_t mapping_size = 0;
+	bool dirty = false;
+	std::unordered_map<std::string, entry> entries;
+};
+
+#endif /* _PLUGIN_SNAPSHOT_H */
@@ -0,0 +1,101 @@
+#ifndef _PLUGIN_WAIT_H
+#define _PLUGIN_WAIT_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+
+// Wait for a condition that is made true by another thread (spike), first by
+// spinning, then by yielding and finally by sleeping until notify() is called.
+// The time spent in each phase is accumulated so that the limits can be tuned.
+struct adaptive_waiter
+{
+	enum phase { SPIN, YIELD, SLEEP, NUM_PHASES };
+
+	unsigned spin_limit = 4096;  // Number of checks before yielding.
+	unsigned yield_limit = 64;   // Number of yields before sleeping.
+	// If nonzero, recheck the condition this often while sleeping. Needed when the
+	// condition is made true by another process, which cannot call notify().
+	std::chrono::microseconds sleep_poll{0};
+
+	template <typename Pred>
+	void wait(Pred ready)
+	{
+		clock::time_point start = clock::now();
+		for (unsigned i = 0; i < spin_limit; ++i) {
+			if (ready()) {
+				account(SPIN, start, true);
+				return;
+			}
+		}
+
+		clock::time_point spun = account(SPIN, start, false);
+		for (unsigned i = 0; i < yield_limit; ++i) {
+			std::this_thread::yield();
+			if (ready()) {
+				account(YIELD, spun, true);
+				return;
+			}
+		}
+
+		clock::time_point yielded = account(YIELD, spun, false);
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			sleeping.store(true, std::memory_order_relaxed);
+			// Pairs with the fence in notify(): either we see the condition or notify() sees us sleeping.
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			while (!ready()) {
+				if (sleep_poll.count())
+					cv.wait_for(lock, sleep_poll);
+				else
+					cv.wait(lock);
+			}
+			sleeping.store(false, std::memory_order_relaxed);
+		}
+		account(SLEEP, yielded, true);
+	}
+
+	// Called after the condition may have become true.
+	void notify()
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (sleeping.load(std::memory_order_relaxed)) {
+			std::lock_guard<std::mutex> lock(mutex);
+			cv.notify_one();
+		}
+	}
+
+	void report(std::FILE* out) const
+	{
+		static const char* names[NUM_PHASES] = {"spin", "yield", "sleep"};
+		std::fprintf(out, "wait statistics (spin=%u, yield=%u):\n", spin_limit, yield_limit);
+		for (int p = 0; p < NUM_PHASES; ++p) {
+			double total_ms = std::chrono::duration<double, std::milli>(time[p]).count();
+			std::fprintf(out, "  %-5s: %10lu waits ended, %12.3f ms spent\n", names[p], completed[p], total_ms);
+		}
+	}
+
+private:
+	using clock = std::chrono::steady_clock;
+
+	// Add the time since start to the given phase, returns the current time.
+	clock::time_point account(phase p, clock::time_point start, bool done)
+	{
+		clock::time_point now = clock::now();
+		time[p] += now - start;
+		if (done)
+			++completed[p];
+		return now;
+	}
+
+	std::mutex mutex;
+	std::condition_variable cv;
+	std::atomic<bool> sleeping{false};
+	clock::duration time[NUM_PHASES] = {};
+	unsigned long completed[NUM_PHASES] = {};
+};
+
+#endif /* _PLUGIN_WAIT_H */
@@ -1,5 +1,6 @@
 #include <assert.h>
 #include <math.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include "graphics.h"
@@ -17,6 +18,16 @@ typedef union pixel {
 
 /* framebuffer management */
 
+static const reloc_t g_framebuffer_relocs[] = {
+    {offsetof(framebuffer_t, color_buffer), NULL},
+    {offsetof(framebuffer_t, depth_buffer), NULL},
+};
+
+const layout_t framebuffer_layout = {
+    sizeof(framebuffer_t), ARRAY_SIZE(g_framebuffer_relocs),
+    g_framebuffer_relocs
+};
+
 framebuffer_t *framebuffer_create(int width, int height) {
     int color_buffer_size = width * height * 4;
     int depth_buffer_size = sizeof(float) * width * height;
@@ -26,12 +37,15 @@ framebuffer_t *framebuffer_create(int width, int height) {
 
     assert(width > 0 && height > 0);
 
-    framebuffer = (framebuffer_t*)plugin_malloc(sizeof(framebuffer_t));
+    framebuffer = (framebuffer_t*)plugin_malloc(sizeof(framebuffer_t),
+                                                PLUGIN_TAG_FRAMEBUFFER);
     framebuffer->width = width;
     framebuffer->height = height;
-    framebuffer->color_buffer = (unsigned char*)plugin_malloc(color_buffer_size);
+    framebuffer->color_buffer = (unsigned char*)plugin_malloc(
+        color_buffer_size, PLUGIN_TAG_FRAMEBUFFER);
     plugin_update_fbaddr(framebuffer->color_buffer);
-    framebuffer->depth_buffer = (float*)plugin_malloc(depth_buffer_size);
+    framebuffer->depth_buffer = (float*)plugin_malloc(
+        depth_buffer_size, PLUGIN_TAG_FRAMEBUFFER);
 
     framebuffer_clear_color(framebuffer, default_color);
     framebuffer_clear_depth(framebuffer, default_depth);
@@ -76,7 +90,7 @@ program_t *program_create(
     assert(sizeof_attribs > 0 && sizeof_varyings > 0 && sizeof_uniforms > 0);
     assert(sizeof_varyings % sizeof(float) == 0);
 
-    program = (program_t*)plugin_malloc(sizeof(program_t));
+    program = (program_t*)plugin_malloc(sizeof(program_t), PLUGIN_TAG_PROGRAM);
 
     program->vertex_shader = vertex_shader;
     program->fragment_shader = fragment_shader;
@@ -85,19 +99,25 @@ program_t *program_create(
     program->sizeof_uniforms = sizeof_uniforms;
     program->double_sided = double_sided;
     program->enable_blend = enable_blend;
+    program->fs_precision = PRECISION_FLOAT;
 
     for (i = 0; i < 3; i++) {
-        program->shader_attribs[i] = plugin_malloc(sizeof_attribs);
+        program->shader_attribs[i] = plugin_malloc(sizeof_attribs,
+                                                   PLUGIN_TAG_PROGRAM);
         memset(program->shader_attribs[i], 0, sizeof_attribs);
     }
-    program->shader_varyings = plugin_malloc(sizeof_varyings);
+    program->shader_varyings = plugin_malloc(sizeof_varyings,
+                                             PLUGIN_TAG_VARYINGS);
     memset(program->shader_varyings, 0, sizeof_varyings);
-    program->shader_uniforms = plugin_malloc(sizeof_uniforms);
+    program->shader_uniforms = plugin_malloc(sizeof_uniforms,
+                                             PLUGIN_TAG_UNIFORMS);
     memset(program->shader_uniforms, 0, sizeof_uniforms);
     for (i = 0; i < MAX_VARYINGS; i++) {
-        program->in_varyings[i] = plugin_malloc(sizeof_varyings);
+        program->in_varyings[i] = plugin_malloc(sizeof_varyings,
+                                                PLUGIN_TAG_VARYINGS);
         memset(program->in_varyings[i], 0, sizeof_varyings);
-        program->out_varyings[i] = plugin_malloc(sizeof_varyings);
+        program->out_varyings[i] = plugin_malloc(sizeof_varyings,
+                                                 PLUGIN_TAG_VARYINGS);
         memset(program->out_varyings[i], 0, sizeof_varyings);
     }
 
@@ -414,16 +434,38 @@ static void interpolate_varyings(
     }
 }
 
-static void draw_fragment(framebuffer_t *framebuffer, program_t *program,
-                          int backface, int index, float depth) {
-    vec4_t color;
-    int discard;
+/*
+ * fragment shaders of a lower precision take the varyings in the same order,
+ * as Q16.16 integers or as binary16 halves packed at the start, so that the
+ * shader does no float arithmetic on them
+ */
+static void convert_varyings(void *varyings, int sizeof_varyings,
+                             precision_t precision) {
+    int num_floats = sizeof_varyings / sizeof(float);
+    float *src = (float*)varyings;
+    int i;
+    if (precision == PRECISION_FIXED) {
+        int *dst = (int*)varyings;
+        for (i = 0; i < num_floats; i++) {
+            dst[i] = float_to_fixed(src[i]);
+        }
+    } else if (precision == PRECISION_HALF) {
+        unsigned short *dst = (unsigned short*)varyings;
+        for (i = 0; i < num_floats; i++) {
+            dst[i] = float_to_half(src[i]);
+        }
+    }
+}
+
+static void write_fragment(framebuffer_t *framebuffer, program_t *program,
+                           int index, float depth, vec4_t color) {
     pixel_t p = { 0 };
 
-    /* execute fragment shader */
-    discard = 0;
-    color = plugin_fragment_shader(program, &discard, backface);
-    if (discard) {
+    /*
+     * fragments are shaded in batches, so an earlier fragment of the same
+     * batch may have covered this pixel after the early depth test
+     */
+    if (depth > framebuffer->depth_buffer[index]) {
         return;
     }
     color = vec4_saturate(color);
@@ -450,6 +492,107 @@ static void draw_fragment(framebuffer_t *framebuffer, program_t *program,
     framebuffer->depth_buffer[index] = depth;
 }
 
+/*
+ * fragments are queued in the fragment ring of the lane that owns their tile
+ * and shaded on spike with a single command per batch, the results are then
+ * written in order. batches are double-buffered: while spike shades one
+ * batch, the next one is queued behind it in the same rings. the results of
+ * a batch are written before the next one is posted, plugin_draw needs the
+ * mailbox of lane 0, which holds a single command
+ */
+
+static framebuffer_t *g_batch_framebuffer = NULL;
+static program_t *g_batch_program = NULL;
+/* jobs [first, last) of every ring are the batch spike is shading, if any */
+static int g_batch_in_flight = 0;
+static uint64_t g_flight_first[PLUGIN_MAX_LANES];
+static uint64_t g_flight_last[PLUGIN_MAX_LANES];
+
+static void write_results(fs_ring_t *ring, uint64_t first, uint64_t last) {
+    uint64_t i;
+    for (i = first; i != last; i++) {
+        fs_job_t *job = &ring->jobs[PLUGIN_FS_RING_SLOT(i)];
+        fs_result_t *result = &ring->results[PLUGIN_FS_RING_SLOT(i)];
+        if (!result->discard) {
+            vec4_t color = vec4_new(result->color[0], result->color[1],
+                                    result->color[2], result->color[3]);
+            write_fragment(g_batch_framebuffer, g_batch_program,
+                           job->index, job->depth, color);
+        }
+    }
+}
+
+/*
+ * wait for the batch in flight, write its results and post the queued jobs
+ * as the next batch
+ */
+static void cycle_fragments(void) {
+    uint64_t first[PLUGIN_MAX_LANES];
+    uint64_t last[PLUGIN_MAX_LANES];
+    int num_lanes = plugin_num_lanes();
+    int guest_write = plugin_guest_write();
+    int finished = g_batch_in_flight;
+    int pending = 0;
+    int lane;
+
+    if (g_batch_in_flight) {
+        plugin_wait_fragment_shader_batch();
+        g_batch_in_flight = 0;
+    }
+    for (lane = 0; lane < num_lanes; lane++) {
+        fs_ring_t *ring = plugin_fragment_ring(lane);
+        assert(ring->tail == g_flight_last[lane]);
+        first[lane] = g_flight_first[lane];
+        last[lane] = g_flight_last[lane];
+        g_flight_first[lane] = ring->tail;
+        g_flight_last[lane] = ring->head;
+        pending |= ring->head != ring->tail;
+    }
+
+    if (finished && !guest_write) {
+        for (lane = 0; lane < num_lanes; lane++) {
+            fs_ring_t *ring = plugin_fragment_ring(lane);
+            write_results(ring, first[lane], last[lane]);
+        }
+    }
+    if (pending) {
+        /* with write=guest, spike writes the surviving fragments itself */
+        plugin_post_fragment_shader_batch(g_batch_program, guest_write
+                                          ? g_batch_framebuffer : NULL);
+        g_batch_in_flight = 1;
+    }
+}
+
+/* shade every queued fragment and write the results */
+static void flush_fragments(void) {
+    cycle_fragments();
+    cycle_fragments();
+}
+
+static fs_job_t *acquire_fragment(framebuffer_t *framebuffer,
+                                  program_t *program, int x, int y) {
+    int lane = PLUGIN_TILE_LANE(x, y, plugin_num_lanes());
+    fs_ring_t *ring = plugin_fragment_ring(lane);
+
+    assert(program->sizeof_varyings <= (int)sizeof(ring->jobs[0].varyings));
+    if (framebuffer != g_batch_framebuffer || program != g_batch_program) {
+        flush_fragments();
+        g_batch_framebuffer = framebuffer;
+        g_batch_program = program;
+    }
+    /* half of the ring is the batch in flight, the other half the next one */
+    if (ring->head - g_flight_last[lane] == PLUGIN_FS_RING_SIZE / 2) {
+        cycle_fragments();
+    }
+    return &ring->jobs[PLUGIN_FS_RING_SLOT(ring->head)];
+}
+
+static void submit_fragment(int x, int y) {
+    int lane = PLUGIN_TILE_LANE(x, y, plugin_num_lanes());
+    fs_ring_t *ring = plugin_fragment_ring(lane);
+    ring->head += 1;
+}
+
 static int rasterize_triangle(framebuffer_t *framebuffer, program_t *program,
                               vec4_t clip_coords[3], void *varyings[3]) {
     int width = framebuffer->width;
@@ -500,10 +643,20 @@ static int rasterize_triangle(framebuffer_t *framebuffer, program_t *program,
                 float depth = interpolate_depth(screen_depths, weights);
                 /* early depth testing */
                 if (depth <= framebuffer->depth_buffer[index]) {
-                    interpolate_varyings(varyings, program->shader_varyings,
+                    fs_job_t *job = acquire_fragment(framebuffer, program,
+                                                     x, y);
+                    interpolate_varyings(varyings, job->varyings,
                                          program->sizeof_varyings,
                                          weights, recip_w);
-                    draw_fragment(framebuffer, program, backface, index, depth);
+                    if (program->fs_precision != PRECISION_FLOAT) {
+                        convert_varyings(job->varyings,
+                                         program->sizeof_varyings,
+                                         program->fs_precision);
+                    }
+                    job->index = index;
+                    job->backface = backface;
+                    job->depth = depth;
+                    submit_fragment(x, y);
                 }
             }
         }
@@ -512,16 +665,10 @@ static int rasterize_triangle(framebuffer_t *framebuffer, program_t *program,
     return 0;
 }
 
-void graphics_draw_triangle(framebuffer_t *framebuffer, program_t *program) {
+static void assemble_triangle(framebuffer_t *framebuffer, program_t *program) {
     int num_vertices;
     int i;
 
-    /* execute vertex shader */
-    for (i = 0; i < 3; i++) {
-        vec4_t clip_coord = plugin_vertex_shader(program, i);
-        program->in_coords[i] = clip_coord;
-    }
-
     /* triangle clipping */
     num_vertices = clip_triangle(program->sizeof_varyings,
                                  program->in_coords, program->in_varyings,
@@ -551,12 +698,118 @@ void graphics_draw_triangle(framebuffer_t *framebuffer, program_t *program) {
     }
 }
 
+void graphics_draw_triangle(framebuffer_t *framebuffer, program_t *program) {
+    int i;
+
+    /* execute vertex shader */
+    for (i = 0; i < 3; i++) {
+        vec4_t clip_coord = plugin_vertex_shader(program, i);
+        program->in_coords[i] = clip_coord;
+    }
+
+    assemble_triangle(framebuffer, program);
+}
+
+void graphics_draw_mesh(framebuffer_t *framebuffer, program_t *program,
+                        mesh_t *mesh) {
+    int num_vertices = mesh_get_num_faces(mesh) * 3;
+    vertex_t *vertices = mesh_get_vertices(mesh);
+    int sizeof_vertex = sizeof(vertex_t);
+    int stream_size = plugin_vertex_stream_size();
+    int first, i, j;
+
+    assert(program->sizeof_attribs <= sizeof_vertex);
+    assert(program->sizeof_varyings <= PLUGIN_MAX_VARYING_FLOATS * (int)sizeof(float));
+    if (plugin_guest_pipeline()) {
+        /* the whole pipeline runs on spike, one command per draw call */
+        flush_fragments();
+        plugin_draw_mesh(framebuffer, program, vertices, sizeof_vertex,
+                         num_vertices);
+        return;
+    }
+    for (first = 0; first < num_vertices; first += stream_size) {
+        int count = min_integer(num_vertices - first, stream_size);
+        vs_output_t *stream;
+
+        /* execute vertex shader for the whole range at once */
+        stream = plugin_vertex_shader_batch(program, &vertices[first],
+                                            sizeof_vertex, count);
+        for (i = 0; i < count; i += 3) {
+            for (j = 0; j < 3; j++) {
+                vs_output_t *output = &stream[i + j];
+                program->in_coords[j] = vec4_new(output->coord[0],
+                                                 output->coord[1],
+                                                 output->coord[2],
+                                                 output->coord[3]);
+                memcpy(program->in_varyings[j], output->varyings,
+                       program->sizeof_varyings);
+            }
+            assemble_triangle(framebuffer, program);
+        }
+    }
+}
+
+/*
+ * draw calls leave their last fragments queued or in flight, flush before
+ * the host reads or clears a framebuffer that was drawn to
+ */
+void graphics_flush(void) {
+    flush_fragments();
+}
+
 void spike_set_fs(program_t *program, const char* file_name)
 {
-    program->fragment_shader = (fragment_shader_t*) plugin_set_shader(file_name, 0);
+    spike_set_fs_precision(program, file_name, PRECISION_FLOAT);
+}
+
+/* the rasterizer converts the varyings of every fragment to the precision */
+void spike_set_fs_precision(program_t *program, const char* file_name,
+                            precision_t precision)
+{
+    program->fragment_shader = (fragment_shader_t*) plugin_set_shader(program, file_name, 0);
+    program->fs_precision = precision;
+}
+
+/* precision asked for with the plugin option precision */
+precision_t spike_fs_precision(void)
+{
+    return plugin_fs_precision();
 }
 
 void spike_set_vs(program_t *program, const char* file_name)
 {
-    program->vertex_shader = (vertex_shader_t*) plugin_set_shader(file_name, 1);
+    program->vertex_shader = (vertex_shader_t*) plugin_set_shader(program, file_name, 1);
+}
+
+/* batch shaders stay with the plugin, spike prefers them when loaded */
+void spike_set_fs_batch(program_t *program, const char* file_name)
+{
+    plugin_set_shader(program, file_name, 2);
+}
+
+void spike_set_vs_batch(program_t *program, const char* file_name)
+{
+    plugin_set_shader(program, file_name, 3);
+}
+
+void spike_set_uniform_layout(program_t *program, const layout_t *layout)
+{
+    assert(layout == NULL || layout->size == program->sizeof_uniforms);
+    plugin_set_uniform_layout(program, layout);
+}
+
+/*
+ * fragments of the program still queued were rasterized with the old
+ * uniforms, they are posted as a batch first but not waited for. the commit
+ * then goes to another uniform slot of the plugin, so spike keeps reading the
+ * old one while the plugin builds the new one. the next command of the draw
+ * call waits for the batch, a mailbox holds a single command. fragments of
+ * other programs are never queued here, changing program drains the rings
+ */
+void spike_commit_uniforms(program_t *program)
+{
+    if (program == g_batch_program) {
+        cycle_fragments();
+    }
+    plugin_commit_uniforms(program);
 }
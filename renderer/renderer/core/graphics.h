@@ -2,6 +2,7 @@
 #define GRAPHICS_H
 
 #include "maths.h"
+#include "mesh.h"
 
 typedef struct {
     int width, height;
@@ -16,6 +17,13 @@ typedef vec4_t fragment_shader_t(void *varyings, void *uniforms,
 
 #define MAX_VARYINGS 10
 
+/* precision of the varyings and the lighting math of a fragment shader */
+typedef enum {
+    PRECISION_FLOAT,    /* float, the default */
+    PRECISION_FIXED,    /* Q16.16 in int */
+    PRECISION_HALF      /* binary16, needs Zfh */
+} precision_t;
+
 struct program {
     vertex_shader_t *vertex_shader;
     fragment_shader_t *fragment_shader;
@@ -33,8 +41,31 @@ struct program {
     vec4_t out_coords[MAX_VARYINGS];
     void *in_varyings[MAX_VARYINGS];
     void *out_varyings[MAX_VARYINGS];
+    /* varyings are converted from float before the fragment shader */
+    precision_t fs_precision;
+};
+
+/*
+ * layout of a struct that is read by spike, used to copy it to the spike
+ * address space without walking its members by hand
+ */
+
+typedef struct layout layout_t;
+
+typedef struct {
+    int offset;                 /* offset of a pointer member */
+    const layout_t *target;     /* layout of the pointee, NULL if plain data */
+} reloc_t;
+
+struct layout {
+    int size;
+    int num_relocs;
+    const reloc_t *relocs;
 };
 
+/* layout of framebuffer_t for spike */
+extern const layout_t framebuffer_layout;
+
 /* framebuffer management */
 framebuffer_t *framebuffer_create(int width, int height);
 void framebuffer_release(framebuffer_t *framebuffer);
@@ -52,8 +83,18 @@ void *program_get_uniforms(program_t *program);
 
 /* graphics pipeline */
 void graphics_draw_triangle(framebuffer_t *framebuffer, program_t *program);
+void graphics_draw_mesh(framebuffer_t *framebuffer, program_t *program,
+                        mesh_t *mesh);
+void graphics_flush(void);
 
 void spike_set_fs(program_t *program, const char* file_name);
+void spike_set_fs_precision(program_t *program, const char* file_name,
+                            precision_t precision);
+precision_t spike_fs_precision(void);
 void spike_set_vs(program_t *program, const char* file_name);
+void spike_set_fs_batch(program_t *program, const char* file_name);
+void spike_set_vs_batch(program_t *program, const char* file_name);
+void spike_set_uniform_layout(program_t *program, const layout_t *layout);
+void spike_commit_uniforms(program_t *program);
 
 #endif
@@ -1,6 +1,7 @@
 #include <assert.h>
 #include <math.h>
 #include <stdio.h>
+#include <string.h>
 #include "macro.h"
 #include "maths.h"
 
@@ -56,6 +57,53 @@ float float_aces(float value) {
     return float_saturate(value);
 }
 
+/* Q16.16, saturated to the range of int */
+int float_to_fixed(float value) {
+    double scaled = floor((double)value * 65536 + 0.5);
+    if (scaled >= 2147483647.0) {
+        return 2147483647;
+    } else if (scaled <= -2147483648.0) {
+        return -2147483647 - 1;
+    } else {
+        return (int)scaled;
+    }
+}
+
+/* bits of the nearest binary16, ties to even */
+unsigned short float_to_half(float value) {
+    unsigned int bits, sign, mantissa, half, remainder, halfway;
+    int exponent, shift;
+
+    assert(sizeof(bits) == sizeof(value));
+    memcpy(&bits, &value, sizeof(bits));
+    sign = (bits >> 16) & 0x8000;
+    exponent = (int)((bits >> 23) & 0xFF) - 127 + 15;
+    mantissa = bits & 0x7FFFFF;
+
+    if (exponent >= 31) {                       /* overflow, inf and nan */
+        int is_nan = ((bits >> 23) & 0xFF) == 0xFF && mantissa != 0;
+        return (unsigned short)(sign | (is_nan ? 0x7E00 : 0x7C00));
+    } else if (exponent <= 0) {                 /* subnormal or zero */
+        if (exponent < -10) {
+            return (unsigned short)sign;
+        }
+        mantissa |= 0x800000;
+        shift = 14 - exponent;
+        half = mantissa >> shift;
+        remainder = mantissa & ((1u << shift) - 1);
+        halfway = 1u << (shift - 1);
+    } else {
+        half = ((unsigned int)exponent << 10) | (mantissa >> 13);
+        remainder = mantissa & 0x1FFF;
+        halfway = 0x1000;
+    }
+    /* a carry out of the mantissa correctly bumps the exponent */
+    if (remainder > halfway || (remainder == halfway && (half & 1))) {
+        half += 1;
+    }
+    return (unsigned short)(sign | half);
+}
+
 void float_print(const char *name, float f) {
     printf("float %s = %f\n", name, f);
 }
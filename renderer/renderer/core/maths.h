@@ -19,6 +19,8 @@ unsigned char float_to_uchar(float value);
 float float_srgb2linear(float value);
 float float_linear2srgb(float value);
 float float_aces(float value);
+int float_to_fixed(float value);
+unsigned short float_to_half(float value);
 void float_print(const char *name, float f);
 
 /* vec2 related functions */
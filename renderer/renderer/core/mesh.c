@@ -7,6 +7,7 @@
 #include "maths.h"
 #include "mesh.h"
 #include "private.h"
+#include "../../../framebuffer_plugin/fbplugin.h"
 
 struct mesh {
     int num_faces;
@@ -33,7 +34,9 @@ static mesh_t *build_mesh(
     assert(darray_size(texcoord_indices) == num_indices);
     assert(darray_size(normal_indices) == num_indices);
 
-    vertices = (vertex_t*)malloc(sizeof(vertex_t) * num_indices);
+    /* vertices are read by spike, so they live in shared memory */
+    vertices = (vertex_t*)plugin_malloc(sizeof(vertex_t) * num_indices,
+                                        PLUGIN_TAG_MESH);
     for (i = 0; i < num_indices; i++) {
         int position_index = position_indices[i];
         int texcoord_index = texcoord_indices[i];
@@ -170,10 +173,58 @@ static mesh_t *load_obj(const char *filename) {
     return mesh;
 }
 
+/*
+ * decoded meshes are kept in the snapshot of the plugin as a snapshot_mesh_t
+ * followed by the vertices
+ */
+
+typedef struct {
+    int num_faces;
+    vec3_t center;
+} snapshot_mesh_t;
+
+static mesh_t *mesh_from_snapshot(const char *filename) {
+    size_t size;
+    const snapshot_mesh_t *data;
+    int vertices_size;
+    mesh_t *mesh;
+
+    data = (const snapshot_mesh_t*)plugin_snapshot_find(filename, "mesh",
+                                                        &size);
+    if (data == NULL) {
+        return NULL;
+    }
+    vertices_size = sizeof(vertex_t) * data->num_faces * 3;
+    assert(size == sizeof(snapshot_mesh_t) + vertices_size);
+    mesh = (mesh_t*)malloc(sizeof(mesh_t));
+    mesh->num_faces = data->num_faces;
+    mesh->center = data->center;
+    mesh->vertices = (vertex_t*)plugin_malloc(vertices_size, PLUGIN_TAG_MESH);
+    memcpy(mesh->vertices, data + 1, vertices_size);
+    UNUSED_VAR(size);
+    return mesh;
+}
+
+static void mesh_to_snapshot(mesh_t *mesh, const char *filename) {
+    int vertices_size = sizeof(vertex_t) * mesh->num_faces * 3;
+    snapshot_mesh_t header;
+
+    header.num_faces = mesh->num_faces;
+    header.center = mesh->center;
+    plugin_snapshot_add(filename, "mesh", &header, sizeof(header),
+                        mesh->vertices, vertices_size);
+}
+
 mesh_t *mesh_load(const char *filename) {
     const char *extension = private_get_extension(filename);
+    mesh_t *mesh = mesh_from_snapshot(filename);
+    if (mesh != NULL) {
+        return mesh;
+    }
     if (strcmp(extension, "obj") == 0) {
-        return load_obj(filename);
+        mesh = load_obj(filename);
+        mesh_to_snapshot(mesh, filename);
+        return mesh;
     } else {
         assert(0);
         return NULL;
@@ -181,7 +232,7 @@ mesh_t *mesh_load(const char *filename) {
 }
 
 void mesh_release(mesh_t *mesh) {
-    free(mesh->vertices);
+    plugin_free(mesh->vertices);
     free(mesh);
 }
 
@@ -16,6 +16,9 @@ typedef struct {
     mat4_t light_proj_matrix;
     mat4_t camera_view_matrix;
     mat4_t camera_proj_matrix;
+    /* shared by all models of the frame */
+    mat4_t light_vp_matrix;
+    mat4_t camera_vp_matrix;
     float ambient_intensity;
     float punctual_intensity;
     texture_t *shadow_map;
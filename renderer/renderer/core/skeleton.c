@@ -161,8 +161,10 @@ static joint_t load_joint(FILE *file) {
 static void initialize_cache(skeleton_t *skeleton) {
     int joint_matrix_size = sizeof(mat4_t) * skeleton->num_joints;
     int normal_matrix_size = sizeof(mat3_t) * skeleton->num_joints;
-    skeleton->joint_matrices = (mat4_t*)plugin_malloc(joint_matrix_size);
-    skeleton->normal_matrices = (mat3_t*)plugin_malloc(normal_matrix_size);
+    skeleton->joint_matrices = (mat4_t*)plugin_malloc(joint_matrix_size,
+                                                      PLUGIN_TAG_SKELETON);
+    skeleton->normal_matrices = (mat3_t*)plugin_malloc(normal_matrix_size,
+                                                       PLUGIN_TAG_SKELETON);
     memset(skeleton->joint_matrices, 0, joint_matrix_size);
     memset(skeleton->normal_matrices, 0, normal_matrix_size);
     skeleton->last_time = -1;
@@ -1,13 +1,38 @@
 #include <assert.h>
 #include <math.h>
+#include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "graphics.h"
 #include "image.h"
+#include "macro.h"
 #include "maths.h"
 #include "texture.h"
 #include "../../../framebuffer_plugin/fbplugin.h"
 
+/* layouts for spike */
+
+static const reloc_t g_texture_relocs[] = {
+    {offsetof(texture_t, buffer), NULL},
+};
+
+const layout_t texture_layout = {
+    sizeof(texture_t), ARRAY_SIZE(g_texture_relocs), g_texture_relocs
+};
+
+#define FACE_RELOC(i) \
+    {offsetof(cubemap_t, faces) + (i) * sizeof(texture_t*), &texture_layout}
+
+static const reloc_t g_cubemap_relocs[] = {
+    FACE_RELOC(0), FACE_RELOC(1), FACE_RELOC(2),
+    FACE_RELOC(3), FACE_RELOC(4), FACE_RELOC(5),
+};
+
+const layout_t cubemap_layout = {
+    sizeof(cubemap_t), ARRAY_SIZE(g_cubemap_relocs), g_cubemap_relocs
+};
+
 /* texture related functions */
 
 texture_t *texture_create(int width, int height) {
@@ -16,10 +41,10 @@ texture_t *texture_create(int width, int height) {
 
     assert(width > 0 && height > 0);
 
-    texture = (texture_t*)plugin_malloc(sizeof(texture_t));
+    texture = (texture_t*)plugin_malloc(sizeof(texture_t), PLUGIN_TAG_TEXTURE);
     texture->width = width;
     texture->height = height;
-    texture->buffer = (vec4_t*)plugin_malloc(buffer_size);
+    texture->buffer = (vec4_t*)plugin_malloc(buffer_size, PLUGIN_TAG_TEXTURE);
     memset(texture->buffer, 0, buffer_size);
 
     return texture;
@@ -106,9 +131,49 @@ static void linear_to_srgb(texture_t *texture) {
     }
 }
 
+/*
+ * decoded textures are kept in the snapshot of the plugin as the width and
+ * the height followed by the texels
+ */
+
+static texture_t *texture_from_snapshot(const char *filename,
+                                        const char *kind) {
+    size_t size;
+    const int *data = (const int*)plugin_snapshot_find(filename, kind, &size);
+    texture_t *texture;
+
+    if (data == NULL) {
+        return NULL;
+    }
+    texture = texture_create(data[0], data[1]);
+    assert(size == 4 * sizeof(int)
+                   + sizeof(vec4_t) * texture->width * texture->height);
+    memcpy(texture->buffer, data + 4, size - 4 * sizeof(int));
+    return texture;
+}
+
+static void texture_to_snapshot(texture_t *texture, const char *filename,
+                                const char *kind) {
+    size_t buffer_size = sizeof(vec4_t) * texture->width * texture->height;
+    int header[4];
+
+    header[0] = texture->width;
+    header[1] = texture->height;
+    header[2] = header[3] = 0;
+    plugin_snapshot_add(filename, kind, header, sizeof(header),
+                        texture->buffer, buffer_size);
+}
+
 texture_t *texture_from_file(const char *filename, usage_t usage) {
     texture_t *texture;
     image_t *image;
+    char kind[32];
+
+    sprintf(kind, "texture%d", (int)usage);
+    texture = texture_from_snapshot(filename, kind);
+    if (texture != NULL) {
+        return texture;
+    }
 
     image = image_load(filename);
     texture = texture_create(image->width, image->height);
@@ -124,6 +189,7 @@ texture_t *texture_from_file(const char *filename, usage_t usage) {
         }
     }
     image_release(image);
+    texture_to_snapshot(texture, filename, kind);
 
     return texture;
 }
@@ -143,6 +209,7 @@ void texture_from_colorbuffer(texture_t *texture, framebuffer_t *framebuffer) {
         float a = float_from_uchar(color[3]);
         texture->buffer[i] = vec4_new(r, g, b, a);
     }
+    plugin_invalidate(texture);
 }
 
 void texture_from_depthbuffer(texture_t *texture, framebuffer_t *framebuffer) {
@@ -156,6 +223,7 @@ void texture_from_depthbuffer(texture_t *texture, framebuffer_t *framebuffer) {
         float depth = framebuffer->depth_buffer[i];
         texture->buffer[i] = vec4_new(depth, depth, depth, 1);
     }
+    plugin_invalidate(texture);
 }
 
 vec4_t texture_repeat_sample(texture_t *texture, vec2_t texcoord) {
@@ -186,7 +254,8 @@ cubemap_t *cubemap_from_files(const char *positive_x, const char *negative_x,
                               const char *positive_y, const char *negative_y,
                               const char *positive_z, const char *negative_z,
                               usage_t usage) {
-    cubemap_t *cubemap = (cubemap_t*)malloc(sizeof(cubemap_t));
+    cubemap_t *cubemap = (cubemap_t*)plugin_malloc(sizeof(cubemap_t),
+                                                   PLUGIN_TAG_TEXTURE);
     cubemap->faces[0] = texture_from_file(positive_x, usage);
     cubemap->faces[1] = texture_from_file(negative_x, usage);
     cubemap->faces[2] = texture_from_file(positive_y, usage);
@@ -201,7 +270,7 @@ void cubemap_release(cubemap_t *cubemap) {
     for (i = 0; i < 6; i++) {
         texture_release(cubemap->faces[i]);
     }
-    free(cubemap);
+    plugin_free(cubemap);
 }
 
 /*
@@ -20,6 +20,10 @@ typedef struct {
     texture_t *faces[6];
 } cubemap_t;
 
+/* layouts for spike_set_uniform_layout */
+extern const layout_t texture_layout;
+extern const layout_t cubemap_layout;
+
 /* texture related functions */
 texture_t *texture_create(int width, int height);
 void texture_release(texture_t *texture);
@@ -1,5 +1,7 @@
 #include <math.h>
+#include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
 #include "../core/api.h"
 #include "blinn_shader.h"
 #include "cache_helper.h"
@@ -251,12 +253,24 @@ vec4_t blinn_fragment_shader(void *varyings_, void *uniforms_,
 
 /* high-level api */
 
+static const reloc_t g_uniform_relocs[] = {
+    {offsetof(blinn_uniforms_t, joint_matrices), NULL},
+    {offsetof(blinn_uniforms_t, joint_n_matrices), NULL},
+    {offsetof(blinn_uniforms_t, shadow_map), &texture_layout},
+    {offsetof(blinn_uniforms_t, diffuse_map), &texture_layout},
+    {offsetof(blinn_uniforms_t, specular_map), &texture_layout},
+    {offsetof(blinn_uniforms_t, emission_map), &texture_layout},
+};
+
+static const layout_t g_uniform_layout = {
+    sizeof(blinn_uniforms_t), ARRAY_SIZE(g_uniform_relocs), g_uniform_relocs
+};
+
 static void update_model(model_t *model, perframe_t *perframe) {
     float ambient_intensity = perframe->ambient_intensity;
     float punctual_intensity = perframe->punctual_intensity;
     skeleton_t *skeleton = model->skeleton;
     mat4_t model_matrix = model->transform;
-    mat3_t normal_matrix;
     mat4_t *joint_matrices;
     mat3_t *joint_n_matrices;
     blinn_uniforms_t *uniforms;
@@ -275,48 +289,70 @@ static void update_model(model_t *model, perframe_t *perframe) {
         joint_matrices = NULL;
         joint_n_matrices = NULL;
     }
-    normal_matrix = mat3_inverse_transpose(mat3_from_mat4(model_matrix));
 
     uniforms = (blinn_uniforms_t*)program_get_uniforms(model->program);
-    uniforms->light_dir = perframe->light_dir;
-    uniforms->camera_pos = perframe->camera_pos;
-    uniforms->model_matrix = model_matrix;
-    uniforms->normal_matrix = normal_matrix;
-    uniforms->light_vp_matrix = mat4_mul_mat4(perframe->light_proj_matrix,
-                                              perframe->light_view_matrix);
-    uniforms->camera_vp_matrix = mat4_mul_mat4(perframe->camera_proj_matrix,
-                                               perframe->camera_view_matrix);
+    /* the normal matrix only changes with the transform */
+    if (memcmp(&uniforms->model_matrix, &model_matrix,
+               sizeof(mat4_t)) != 0) {
+        mat3_t normal_matrix = mat3_from_mat4(model_matrix);
+        uniforms->model_matrix = model_matrix;
+        uniforms->normal_matrix = mat3_inverse_transpose(normal_matrix);
+    }
     uniforms->joint_matrices = joint_matrices;
     uniforms->joint_n_matrices = joint_n_matrices;
+    /* per-frame block, computed once in perframe_t */
+    uniforms->light_dir = perframe->light_dir;
+    uniforms->camera_pos = perframe->camera_pos;
+    uniforms->light_vp_matrix = perframe->light_vp_matrix;
+    uniforms->camera_vp_matrix = perframe->camera_vp_matrix;
     uniforms->ambient_intensity = float_clamp(ambient_intensity, 0, 5);
     uniforms->punctual_intensity = float_clamp(punctual_intensity, 0, 5);
     uniforms->shadow_map = perframe->shadow_map;
 }
 
+static void convert_uniforms(blinn_uniforms_t *uniforms,
+                             precision_t precision) {
+    float values[16];
+    int num_values = 0;
+    int i;
+
+    values[num_values++] = uniforms->light_dir.x;
+    values[num_values++] = uniforms->light_dir.y;
+    values[num_values++] = uniforms->light_dir.z;
+    values[num_values++] = uniforms->camera_pos.x;
+    values[num_values++] = uniforms->camera_pos.y;
+    values[num_values++] = uniforms->camera_pos.z;
+    values[num_values++] = uniforms->basecolor.x;
+    values[num_values++] = uniforms->basecolor.y;
+    values[num_values++] = uniforms->basecolor.z;
+    values[num_values++] = uniforms->basecolor.w;
+    values[num_values++] = uniforms->ambient_intensity;
+    values[num_values++] = uniforms->punctual_intensity;
+    values[num_values++] = uniforms->shininess;
+    values[num_values++] = uniforms->alpha_cutoff;
+
+    /* both copies are arrays of these values in this order */
+    for (i = 0; i < num_values; i++) {
+        if (precision == PRECISION_FIXED) {
+            ((int*)&uniforms->fixed)[i] = float_to_fixed(values[i]);
+        } else {
+            ((unsigned short*)&uniforms->half)[i] = float_to_half(values[i]);
+        }
+    }
+}
+
 static void draw_model(model_t *model, framebuffer_t *framebuffer,
                        int shadow_pass) {
-    mesh_t *mesh = model->mesh;
-    int num_faces = mesh_get_num_faces(mesh);
-    vertex_t *vertices = mesh_get_vertices(mesh);
-    program_t *program = model->program;
+    precision_t precision = model->program->fs_precision;
     blinn_uniforms_t *uniforms;
-    blinn_attribs_t *attribs;
-    int i, j;
 
     uniforms = (blinn_uniforms_t*)program_get_uniforms(model->program);
     uniforms->shadow_pass = shadow_pass;
-    for (i = 0; i < num_faces; i++) {
-        for (j = 0; j < 3; j++) {
-            vertex_t vertex = vertices[i * 3 + j];
-            attribs = (blinn_attribs_t*)program_get_attribs(program, j);
-            attribs->position = vertex.position;
-            attribs->texcoord = vertex.texcoord;
-            attribs->normal = vertex.normal;
-            attribs->joint = vertex.joint;
-            attribs->weight = vertex.weight;
-        }
-        graphics_draw_triangle(framebuffer, program);
+    if (precision != PRECISION_FLOAT) {
+        convert_uniforms(uniforms, precision);
     }
+    spike_commit_uniforms(model->program);
+    graphics_draw_mesh(framebuffer, model->program, model->mesh);
 }
 
 static void release_model(model_t *model) {
@@ -342,14 +378,26 @@ model_t *blinn_create_model(const char *mesh, mat4_t transform,
     int sizeof_varyings = sizeof(blinn_varyings_t);
     int sizeof_uniforms = sizeof(blinn_uniforms_t);
     blinn_uniforms_t *uniforms;
+    precision_t precision;
     program_t *program;
     model_t *model;
 
     program = program_create(blinn_vertex_shader, blinn_fragment_shader,
                              sizeof_attribs, sizeof_varyings, sizeof_uniforms,
                              material->double_sided, material->enable_blend);
-    spike_set_fs(program, FRAG_SHADER_PATH);
+    precision = spike_fs_precision();
+    if (precision == PRECISION_FIXED) {
+        spike_set_fs_precision(program, FRAG_FIXED_SHADER_PATH, precision);
+    } else if (precision == PRECISION_HALF) {
+        spike_set_fs_precision(program, FRAG_HALF_SHADER_PATH, precision);
+    } else {
+        /* the batch fragment shader takes float varyings */
+        spike_set_fs(program, FRAG_SHADER_PATH);
+        spike_set_fs_batch(program, FRAG_BATCH_SHADER_PATH);
+    }
     spike_set_vs(program, VERT_SHADER_PATH);
+    spike_set_vs_batch(program, VERT_BATCH_SHADER_PATH);
+    spike_set_uniform_layout(program, &g_uniform_layout);
 
     uniforms = (blinn_uniforms_t*)program_get_uniforms(program);
     uniforms->basecolor = material->basecolor;
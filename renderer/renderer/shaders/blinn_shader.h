@@ -5,10 +5,12 @@
 
 /* low-level api */
 
+/* same layout as vertex_t, so mesh vertices can be used as attribs directly */
 typedef struct {
     vec3_t position;
     vec2_t texcoord;
     vec3_t normal;
+    vec4_t tangent;
     vec4_t joint;
     vec4_t weight;
 } blinn_attribs_t;
@@ -20,6 +22,30 @@ typedef struct {
     vec3_t normal;
 } blinn_varyings_t;
 
+/*
+ * inputs of the lighting in the fixed-point (Q16.16) and half precision
+ * fragment shaders, converted from the float uniforms before every draw
+ */
+typedef struct {
+    int light_dir[3];
+    int camera_pos[3];
+    int basecolor[4];
+    int ambient_intensity;
+    int punctual_intensity;
+    int shininess;
+    int alpha_cutoff;
+} blinn_fixed_t;
+
+typedef struct {
+    unsigned short light_dir[3];
+    unsigned short camera_pos[3];
+    unsigned short basecolor[4];
+    unsigned short ambient_intensity;
+    unsigned short punctual_intensity;
+    unsigned short shininess;
+    unsigned short alpha_cutoff;
+} blinn_half_t;
+
 typedef struct {
     vec3_t light_dir;
     vec3_t camera_pos;
@@ -41,6 +67,9 @@ typedef struct {
     /* render controls */
     float alpha_cutoff;
     int shadow_pass;
+    /* lower precision copies, see spike_set_fs_precision */
+    blinn_fixed_t fixed;
+    blinn_half_t half;
 } blinn_uniforms_t;
 
 vec4_t blinn_vertex_shader(void *attribs, void *varyings, void *uniforms);
@@ -5,6 +5,7 @@
 #include "../core/api.h"
 #include "cache_helper.h"
 #include "pbr_shader.h"
+#include "../../../framebuffer_plugin/fbplugin.h"
 
 static char *duplicate_string(const char *source) {
     char *target = (char*)malloc(strlen(source) + 1);
@@ -308,7 +309,7 @@ static ibldata_t *load_ibldata(const char *env_name, int mip_levels) {
     ibldata_t *ibldata;
     int i, j;
 
-    ibldata = (ibldata_t*)malloc(sizeof(ibldata_t));
+    ibldata = (ibldata_t*)plugin_malloc(sizeof(ibldata_t), PLUGIN_TAG_TEXTURE);
     memset(ibldata, 0, sizeof(ibldata_t));
     ibldata->mip_levels = mip_levels;
 
@@ -345,7 +346,7 @@ static void free_ibldata(ibldata_t *ibldata) {
         cubemap_release(ibldata->specular_maps[i]);
     }
     cache_release_texture(ibldata->brdf_lut);
-    free(ibldata);
+    plugin_free(ibldata);
 }
 
 ibldata_t *cache_acquire_ibldata(const char *env_name) {
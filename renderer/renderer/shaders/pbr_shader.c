@@ -1,9 +1,11 @@
 #include <math.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include "../core/api.h"
 #include "cache_helper.h"
 #include "pbr_shader.h"
+#include "shader_paths.h"
 
 /* low-level api */
 
@@ -503,12 +505,50 @@ vec4_t pbr_fragment_shader(void *varyings_, void *uniforms_,
 
 /* high-level api */
 
+#define SPECULAR_RELOC(i) {                                                 \
+        offsetof(ibldata_t, specular_maps) + (i) * sizeof(cubemap_t*),      \
+        &cubemap_layout                                                     \
+    }
+
+static const reloc_t g_ibldata_relocs[] = {
+    {offsetof(ibldata_t, diffuse_map), &cubemap_layout},
+    SPECULAR_RELOC(0), SPECULAR_RELOC(1), SPECULAR_RELOC(2),
+    SPECULAR_RELOC(3), SPECULAR_RELOC(4), SPECULAR_RELOC(5),
+    SPECULAR_RELOC(6), SPECULAR_RELOC(7), SPECULAR_RELOC(8),
+    SPECULAR_RELOC(9), SPECULAR_RELOC(10), SPECULAR_RELOC(11),
+    SPECULAR_RELOC(12), SPECULAR_RELOC(13), SPECULAR_RELOC(14),
+    {offsetof(ibldata_t, brdf_lut), &texture_layout},
+};
+
+static const layout_t g_ibldata_layout = {
+    sizeof(ibldata_t), ARRAY_SIZE(g_ibldata_relocs), g_ibldata_relocs
+};
+
+static const reloc_t g_uniform_relocs[] = {
+    {offsetof(pbr_uniforms_t, joint_matrices), NULL},
+    {offsetof(pbr_uniforms_t, joint_n_matrices), NULL},
+    {offsetof(pbr_uniforms_t, shadow_map), &texture_layout},
+    {offsetof(pbr_uniforms_t, basecolor_map), &texture_layout},
+    {offsetof(pbr_uniforms_t, metalness_map), &texture_layout},
+    {offsetof(pbr_uniforms_t, roughness_map), &texture_layout},
+    {offsetof(pbr_uniforms_t, diffuse_map), &texture_layout},
+    {offsetof(pbr_uniforms_t, specular_map), &texture_layout},
+    {offsetof(pbr_uniforms_t, glossiness_map), &texture_layout},
+    {offsetof(pbr_uniforms_t, normal_map), &texture_layout},
+    {offsetof(pbr_uniforms_t, occlusion_map), &texture_layout},
+    {offsetof(pbr_uniforms_t, emission_map), &texture_layout},
+    {offsetof(pbr_uniforms_t, ibldata), &g_ibldata_layout},
+};
+
+static const layout_t g_uniform_layout = {
+    sizeof(pbr_uniforms_t), ARRAY_SIZE(g_uniform_relocs), g_uniform_relocs
+};
+
 static void update_model(model_t *model, perframe_t *perframe) {
     float ambient_intensity = perframe->ambient_intensity;
     float punctual_intensity = perframe->punctual_intensity;
     skeleton_t *skeleton = model->skeleton;
     mat4_t model_matrix = model->transform;
-    mat3_t normal_matrix;
     mat4_t *joint_matrices;
     mat3_t *joint_n_matrices;
     pbr_uniforms_t *uniforms;
@@ -527,19 +567,22 @@ static void update_model(model_t *model, perframe_t *perframe) {
         joint_matrices = NULL;
         joint_n_matrices = NULL;
     }
-    normal_matrix = mat3_inverse_transpose(mat3_from_mat4(model_matrix));
 
     uniforms = (pbr_uniforms_t*)program_get_uniforms(model->program);
-    uniforms->light_dir = perframe->light_dir;
-    uniforms->camera_pos = perframe->camera_pos;
-    uniforms->model_matrix = model_matrix;
-    uniforms->normal_matrix = normal_matrix;
-    uniforms->light_vp_matrix = mat4_mul_mat4(perframe->light_proj_matrix,
-                                              perframe->light_view_matrix);
-    uniforms->camera_vp_matrix = mat4_mul_mat4(perframe->camera_proj_matrix,
-                                               perframe->camera_view_matrix);
+    /* the normal matrix only changes with the transform */
+    if (memcmp(&uniforms->model_matrix, &model_matrix,
+               sizeof(mat4_t)) != 0) {
+        mat3_t normal_matrix = mat3_from_mat4(model_matrix);
+        uniforms->model_matrix = model_matrix;
+        uniforms->normal_matrix = mat3_inverse_transpose(normal_matrix);
+    }
     uniforms->joint_matrices = joint_matrices;
     uniforms->joint_n_matrices = joint_n_matrices;
+    /* per-frame block, computed once in perframe_t */
+    uniforms->light_dir = perframe->light_dir;
+    uniforms->camera_pos = perframe->camera_pos;
+    uniforms->light_vp_matrix = perframe->light_vp_matrix;
+    uniforms->camera_vp_matrix = perframe->camera_vp_matrix;
     uniforms->ambient_intensity = float_clamp(ambient_intensity, 0, 5);
     uniforms->punctual_intensity = float_clamp(punctual_intensity, 0, 5);
     uniforms->shadow_map = perframe->shadow_map;
@@ -548,29 +591,12 @@ static void update_model(model_t *model, perframe_t *perframe) {
 
 static void draw_model(model_t *model, framebuffer_t *framebuffer,
                        int shadow_pass) {
-    mesh_t *mesh = model->mesh;
-    int num_faces = mesh_get_num_faces(mesh);
-    vertex_t *vertices = mesh_get_vertices(mesh);
-    program_t *program = model->program;
     pbr_uniforms_t *uniforms;
-    pbr_attribs_t *attribs;
-    int i, j;
 
     uniforms = (pbr_uniforms_t*)program_get_uniforms(model->program);
     uniforms->shadow_pass = shadow_pass;
-    for (i = 0; i < num_faces; i++) {
-        for (j = 0; j < 3; j++) {
-            vertex_t vertex = vertices[i * 3 + j];
-            attribs = (pbr_attribs_t*)program_get_attribs(program, j);
-            attribs->position = vertex.position;
-            attribs->texcoord = vertex.texcoord;
-            attribs->normal = vertex.normal;
-            attribs->tangent = vertex.tangent;
-            attribs->joint = vertex.joint;
-            attribs->weight = vertex.weight;
-        }
-        graphics_draw_triangle(framebuffer, program);
-    }
+    spike_commit_uniforms(model->program);
+    graphics_draw_mesh(framebuffer, model->program, model->mesh);
 }
 
 static void release_model(model_t *model) {
@@ -604,6 +630,9 @@ static model_t *create_model(const char *mesh, mat4_t transform,
     program = program_create(pbr_vertex_shader, pbr_fragment_shader,
                              sizeof_attribs, sizeof_varyings, sizeof_uniforms,
                              double_sided, enable_blend);
+    spike_set_fs(program, PBR_FRAG_SHADER_PATH);
+    spike_set_vs(program, PBR_VERT_SHADER_PATH);
+    spike_set_uniform_layout(program, &g_uniform_layout);
 
     model = (model_t*)malloc(sizeof(model_t));
     model->mesh = cache_acquire_mesh(mesh);
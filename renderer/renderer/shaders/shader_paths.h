@@ -2,6 +2,14 @@
 #define SHADER_PATHS_H
 
 #define FRAG_SHADER_PATH "/home/angelos/Projects/renderer_plugin/spike/fragA.rv64"
+#define FRAG_FIXED_SHADER_PATH "/home/angelos/Projects/renderer_plugin/spike/fragAQ.rv64"
+#define FRAG_HALF_SHADER_PATH "/home/angelos/Projects/renderer_plugin/spike/fragAH.rv64"
 #define VERT_SHADER_PATH "/home/angelos/Projects/renderer_plugin/spike/vertA.rv64"
+#define FRAG_BATCH_SHADER_PATH "/home/angelos/Projects/renderer_plugin/spike/fragAV.rv64"
+#define VERT_BATCH_SHADER_PATH "/home/angelos/Projects/renderer_plugin/spike/vertAV.rv64"
+#define PBR_FRAG_SHADER_PATH "/home/angelos/Projects/renderer_plugin/spike/fragPbr.rv64"
+#define PBR_VERT_SHADER_PATH "/home/angelos/Projects/renderer_plugin/spike/vertPbr.rv64"
+#define SKYBOX_FRAG_SHADER_PATH "/home/angelos/Projects/renderer_plugin/spike/fragSkybox.rv64"
+#define SKYBOX_VERT_SHADER_PATH "/home/angelos/Projects/renderer_plugin/spike/vertSkybox.rv64"
 
 #endif
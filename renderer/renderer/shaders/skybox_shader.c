@@ -1,6 +1,8 @@
+#include <stddef.h>
 #include <stdlib.h>
 #include "../core/api.h"
 #include "cache_helper.h"
+#include "shader_paths.h"
 #include "skybox_shader.h"
 
 /* low-level api */
@@ -30,6 +32,14 @@ vec4_t skybox_fragment_shader(void *varyings_, void *uniforms_,
 
 /* high-level api */
 
+static const reloc_t g_uniform_relocs[] = {
+    {offsetof(skybox_uniforms_t, skybox), &cubemap_layout},
+};
+
+static const layout_t g_uniform_layout = {
+    sizeof(skybox_uniforms_t), ARRAY_SIZE(g_uniform_relocs), g_uniform_relocs
+};
+
 static void update_model(model_t *model, perframe_t *perframe) {
     mat4_t view_matrix = perframe->camera_view_matrix;
     mat4_t proj_matrix = perframe->camera_proj_matrix;
@@ -47,21 +57,8 @@ static void update_model(model_t *model, perframe_t *perframe) {
 static void draw_model(model_t *model, framebuffer_t *framebuffer,
                        int shadow_pass) {
     if (!shadow_pass) {
-        mesh_t *mesh = model->mesh;
-        int num_faces = mesh_get_num_faces(mesh);
-        vertex_t *vertices = mesh_get_vertices(mesh);
-        program_t *program = model->program;
-        skybox_attribs_t *attribs;
-        int i, j;
-
-        for (i = 0; i < num_faces; i++) {
-            for (j = 0; j < 3; j++) {
-                vertex_t vertex = vertices[i * 3 + j];
-                attribs = (skybox_attribs_t*)program_get_attribs(program, j);
-                attribs->position = vertex.position;
-            }
-            graphics_draw_triangle(framebuffer, program);
-        }
+        spike_commit_uniforms(model->program);
+        graphics_draw_mesh(framebuffer, model->program, model->mesh);
     }
 }
 
@@ -85,6 +82,9 @@ model_t *skybox_create_model(const char *skybox_name, int blur_level) {
     program = program_create(skybox_vertex_shader, skybox_fragment_shader,
                              sizeof_attribs, sizeof_varyings, sizeof_uniforms,
                              1, 0);
+    spike_set_fs(program, SKYBOX_FRAG_SHADER_PATH);
+    spike_set_vs(program, SKYBOX_VERT_SHADER_PATH);
+    spike_set_uniform_layout(program, &g_uniform_layout);
 
     uniforms = (skybox_uniforms_t*)program_get_uniforms(program);
     uniforms->skybox = cache_acquire_skybox(skybox_name, blur_level);
@@ -3,7 +3,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include "../core/api.h"
+#include "../core/private.h"
 #include "test_helper.h"
+#include "../../../framebuffer_plugin/fbplugin.h"
 
 /* mainloop related functions */
 
@@ -168,6 +170,110 @@ static vec3_t get_light_dir(record_t *record) {
     return vec3_new(-x, -y, -z);
 }
 
+/*
+ * with the plugin option reference=<dir>, float runs save their first frames
+ * there and runs of a lower precision report how far their frames are from
+ * them, as the psnr and the largest error of a channel
+ */
+
+static const int REFERENCE_FRAMES = 16;
+
+typedef struct {
+    int num_frames;
+    double sum_squares;     /* of the channel errors */
+    long num_channels;
+    long num_differing;     /* pixels with any channel differing */
+    long num_pixels;
+    int max_error;
+} difference_t;
+
+static void print_difference(const char *what, difference_t *difference) {
+    double differing = 100.0 * (double)difference->num_differing
+                       / (double)difference->num_pixels;
+    char psnr[32];
+    if (difference->sum_squares > 0) {
+        double mse = difference->sum_squares
+                     / (double)difference->num_channels;
+        sprintf(psnr, "%.2f dB", 10 * log10(255.0 * 255.0 / mse));
+    } else {
+        strcpy(psnr, "inf");
+    }
+    printf("reference: %s, psnr %s, max error %d, %.2f%% of pixels differ\n",
+           what, psnr, difference->max_error, differing);
+}
+
+static void compare_frame(image_t *frame, image_t *reference, int index,
+                          difference_t *total) {
+    difference_t difference;
+    char what[32];
+    int i, j;
+
+    memset(&difference, 0, sizeof(difference_t));
+    difference.num_frames = 1;
+    for (i = 0; i < frame->width * frame->height; i++) {
+        unsigned char *pixel = &frame->ldr_buffer[i * frame->channels];
+        unsigned char *expected =
+            &reference->ldr_buffer[i * reference->channels];
+        int differs = 0;
+        for (j = 0; j < 3; j++) {
+            int error = abs((int)pixel[j] - (int)expected[j]);
+            difference.sum_squares += (double)(error * error);
+            if (error > difference.max_error) {
+                difference.max_error = error;
+            }
+            differs |= error != 0;
+        }
+        difference.num_channels += 3;
+        difference.num_differing += differs;
+        difference.num_pixels += 1;
+    }
+
+    sprintf(what, "frame %d", index);
+    print_difference(what, &difference);
+    total->num_frames += 1;
+    total->sum_squares += difference.sum_squares;
+    total->num_channels += difference.num_channels;
+    total->num_differing += difference.num_differing;
+    total->num_pixels += difference.num_pixels;
+    if (difference.max_error > total->max_error) {
+        total->max_error = difference.max_error;
+    }
+}
+
+static void reference_frame(framebuffer_t *framebuffer, int index,
+                            difference_t *total) {
+    const char *directory = plugin_reference_dir();
+    char filename[256];
+    image_t *frame;
+
+    if (directory == NULL || index >= REFERENCE_FRAMES
+            || strlen(directory) + 16 > sizeof(filename)) {
+        return;
+    }
+    sprintf(filename, "%s/frame%02d.tga", directory, index);
+    frame = image_create(framebuffer->width, framebuffer->height, 4,
+                         FORMAT_LDR);
+    private_blit_rgb(framebuffer, frame);
+
+    if (spike_fs_precision() == PRECISION_FLOAT) {
+        image_save(frame, filename);
+    } else {
+        FILE *file = fopen(filename, "rb");
+        if (file != NULL) {
+            image_t *reference;
+            fclose(file);
+            reference = image_load(filename);
+            if (reference->width == frame->width
+                    && reference->height == frame->height
+                    && reference->channels >= 3) {
+                compare_frame(frame, reference, index, total);
+            }
+            image_release(reference);
+        }
+    }
+    image_release(frame);
+}
+
 void test_enter_mainloop(tickfunc_t *tickfunc, void *userdata) {
     window_t *window;
     framebuffer_t *framebuffer;
@@ -179,6 +285,8 @@ void test_enter_mainloop(tickfunc_t *tickfunc, void *userdata) {
     float prev_time;
     float print_time;
     int num_frames;
+    int frame_index;
+    difference_t difference;
 
     window = window_create(WINDOW_TITLE, WINDOW_WIDTH, WINDOW_HEIGHT);
     framebuffer = framebuffer_create(WINDOW_WIDTH, WINDOW_HEIGHT);
@@ -200,6 +308,8 @@ void test_enter_mainloop(tickfunc_t *tickfunc, void *userdata) {
     window_set_userdata(window, &record);
     input_set_callbacks(window, callbacks);
 
+    memset(&difference, 0, sizeof(difference_t));
+    frame_index = 0;
     num_frames = 0;
     prev_time = platform_get_time();
     print_time = prev_time;
@@ -220,6 +330,9 @@ void test_enter_mainloop(tickfunc_t *tickfunc, void *userdata) {
         tickfunc(&context, userdata);
 
         window_draw_buffer(window, framebuffer);
+        reference_frame(framebuffer, frame_index, &difference);
+        plugin_end_frame();
+        frame_index += 1;
         num_frames += 1;
         if (curr_time - print_time >= 1) {
             int sum_millis = (int)((curr_time - print_time) * 1000);
@@ -239,6 +352,10 @@ void test_enter_mainloop(tickfunc_t *tickfunc, void *userdata) {
         input_poll_events();
     }
 
+    if (difference.num_frames > 0) {
+        print_difference("all frames", &difference);
+    }
+
     window_destroy(window);
     framebuffer_release(framebuffer);
     camera_release(camera);
@@ -347,6 +464,9 @@ scene_t *test_create_scene(creator_t creators[], const char *scene_name) {
         printf("shadow: %s\n", with_shadow ? "on" : "off");
         printf("ambient: %s\n", with_ambient ? "on" : "off");
         printf("punctual: %s\n", with_punctual ? "on" : "off");
+
+        /* the next run copies the decoded assets from the snapshot */
+        plugin_snapshot_save();
     } else {
         int i;
         printf("scene not found: %s\n", scene_name);
@@ -387,6 +507,10 @@ perframe_t test_build_perframe(scene_t *scene, context_t *context) {
     perframe.light_proj_matrix = get_light_proj_matrix(1, 1, 0, 2);
     perframe.camera_view_matrix = camera_get_view_matrix(camera);
     perframe.camera_proj_matrix = camera_get_proj_matrix(camera);
+    perframe.light_vp_matrix = mat4_mul_mat4(perframe.light_proj_matrix,
+                                             perframe.light_view_matrix);
+    perframe.camera_vp_matrix = mat4_mul_mat4(perframe.camera_proj_matrix,
+                                              perframe.camera_view_matrix);
     perframe.ambient_intensity = scene->ambient_intensity;
     perframe.punctual_intensity = scene->punctual_intensity;
     perframe.shadow_map = scene->shadow_map;
@@ -442,6 +566,7 @@ void test_draw_scene(scene_t *scene, framebuffer_t *framebuffer,
     }
 
     if (scene->shadow_buffer && scene->shadow_map) {
+        plugin_set_pass("shadow");
         sort_models(models, perframe->light_view_matrix);
         framebuffer_clear_depth(scene->shadow_buffer, 1);
         for (i = 0; i < num_models; i++) {
@@ -450,9 +575,11 @@ void test_draw_scene(scene_t *scene, framebuffer_t *framebuffer,
                 model->draw(model, scene->shadow_buffer, 1);
             }
         }
+        graphics_flush();
         texture_from_depthbuffer(scene->shadow_map, scene->shadow_buffer);
     }
 
+    plugin_set_pass("main");
     sort_models(models, perframe->camera_view_matrix);
     framebuffer_clear_color(framebuffer, scene->background);
     framebuffer_clear_depth(framebuffer, 1);
@@ -482,4 +609,5 @@ void test_draw_scene(scene_t *scene, framebuffer_t *framebuffer,
             model->draw(model, framebuffer, 0);
         }
     }
+    graphics_flush();
 }
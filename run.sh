@@ -3,4 +3,28 @@
 ./build_plugin.sh 
 cd spike && ./build_riscv.sh
 cd ../renderer
-spike -m1 --isa=RV64IMFDC --extlib=../plugin.so --device=framebuffer_plugin,0x10000000,triangle `pwd`/../spike/main.rv64
+HARTS=${HARTS:-1}
+WORKERS=${WORKERS:-0}
+DEVICE=0x10000000
+if [ -n "$DIRECT" ]; then
+    # Map shared memory below the mailboxes as spike memory (needs shared_mem.patch), for the default size only.
+    SHARED_MEM="--shared-mem=0x10000000:0x9500000:$DIRECT"
+    DEVICE=0x19500000
+    OPTIONS=",backing=$DIRECT,direct=on"
+fi
+ISA=RV64IMFDC
+if [ -n "$VECTOR" ]; then
+    # Batch shaders built for RVV (spike/shaders/*V.c).
+    ISA=RV64IMFDCV
+    OPTIONS="$OPTIONS,vector=on"
+fi
+if [ -n "$PRECISION" ]; then
+    # fixed or half, the half precision shader needs Zfh.
+    OPTIONS="$OPTIONS,precision=$PRECISION"
+    [ "$PRECISION" = half ] && ISA=${ISA}_Zfh
+fi
+if [ -n "$REFERENCE" ]; then
+    # Directory of the reference frames, written by float runs.
+    OPTIONS="$OPTIONS,reference=$REFERENCE"
+fi
+spike -m80 -p$HARTS $SHARED_MEM --isa=$ISA --extlib=../plugin.so --device=framebuffer_plugin,$DEVICE,triangle,harts=$HARTS,workers=$WORKERS$OPTIONS `pwd`/../spike/main.rv64
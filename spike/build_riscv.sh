@@ -4,3 +4,6 @@
 
 riscv64-unknown-elf-gcc -mabi=lp64d -march=rv64imafd_zicsr_zifencei -fno-strict-aliasing -Wall -Wextra -I../framebuffer_plugin -O2 -g -static -nostartfiles -mcmodel=medany -Wl,-Ttext-segment,0x80000000,-T,ls.ld -o main.rv64 start.S *.c -lm
 riscv64-unknown-elf-objdump -SDls main.rv64 > main.dis
+
+# test of the custom instructions of stfb.patch, needs a patched spike
+riscv64-unknown-elf-gcc -mabi=lp64d -march=rv64imafd_zicsr_zifencei -Wall -Wextra -O2 -g -static -nostartfiles -mcmodel=medany -Wl,-Ttext-segment,0x80000000,-T,ls.ld -o stfb_test.rv64 start.S tests/stfb_test.c -lm
@@ -6,7 +6,29 @@ riscv64-unknown-elf-objdump -SDls fragA.rv64 > fragA.dis
 riscv64-unknown-elf-gcc -mabi=lp64d -march=rv64imafd_zicsr_zifencei -fPIC -Wall -Wextra -O3 -ffast-math -g -static -nostartfiles -mcmodel=medany -Wl,-evertA -o vertA.rv64 ./shaders/vertA.c maths.c -lm
 riscv64-unknown-elf-objdump -SDls vertA.rv64 > vertA.dis
 
+# batch variants of fragA and vertA, loaded with the plugin option vector=on
+riscv64-unknown-elf-gcc -mabi=lp64d -march=rv64imafdv_zicsr_zifencei -fPIC -Wall -Wextra -O3 -ffast-math -g -static -nostartfiles -mcmodel=medany -I../framebuffer_plugin -Wl,-efragAV -o fragAV.rv64 ./shaders/fragAV.c maths.c -lm
+riscv64-unknown-elf-objdump -SDls fragAV.rv64 > fragAV.dis
+riscv64-unknown-elf-gcc -mabi=lp64d -march=rv64imafdv_zicsr_zifencei -fPIC -Wall -Wextra -O3 -ffast-math -g -static -nostartfiles -mcmodel=medany -I../framebuffer_plugin -Wl,-evertAV -o vertAV.rv64 ./shaders/vertAV.c maths.c -lm
+riscv64-unknown-elf-objdump -SDls vertAV.rv64 > vertAV.dis
+
+# fixed-point and half precision variants of fragA, loaded with the plugin option precision=fixed or half
+riscv64-unknown-elf-gcc -mabi=lp64d -march=rv64imafd_zicsr_zifencei -fPIC -Wall -Wextra -O3 -ffast-math -g -static -nostartfiles -mcmodel=medany -Wl,-efragAQ -o fragAQ.rv64 ./shaders/fragAQ.c maths.c -lm
+riscv64-unknown-elf-objdump -SDls fragAQ.rv64 > fragAQ.dis
+riscv64-unknown-elf-gcc -mabi=lp64d -march=rv64imafd_zfh_zicsr_zifencei -fPIC -Wall -Wextra -O3 -ffast-math -g -static -nostartfiles -mcmodel=medany -Wl,-efragAH -o fragAH.rv64 ./shaders/fragAH.c maths.c -lm
+riscv64-unknown-elf-objdump -SDls fragAH.rv64 > fragAH.dis
+
 riscv64-unknown-elf-gcc -mabi=lp64d -march=rv64imafd_zicsr_zifencei -fPIC -Wall -Wextra -O3 -ffast-math -g -static -nostartfiles -mcmodel=medany -Wl,-efragA -o fragB.rv64 ./shaders/fragB.c maths.c -lm
 riscv64-unknown-elf-objdump -SDls fragB.rv64 > fragB.dis
 riscv64-unknown-elf-gcc -mabi=lp64d -march=rv64imafd_zicsr_zifencei -fPIC -Wall -Wextra -O3 -ffast-math -g -static -nostartfiles -mcmodel=medany -Wl,-evertA -o vertB.rv64 ./shaders/vertB.c maths.c -lm
 riscv64-unknown-elf-objdump -SDls vertB.rv64 > vertB.dis
+
+riscv64-unknown-elf-gcc -mabi=lp64d -march=rv64imafd_zicsr_zifencei -fPIC -Wall -Wextra -O3 -ffast-math -g -static -nostartfiles -mcmodel=medany -Wl,-efragPbr -o fragPbr.rv64 ./shaders/fragPbr.c maths.c -lm
+riscv64-unknown-elf-objdump -SDls fragPbr.rv64 > fragPbr.dis
+riscv64-unknown-elf-gcc -mabi=lp64d -march=rv64imafd_zicsr_zifencei -fPIC -Wall -Wextra -O3 -ffast-math -g -static -nostartfiles -mcmodel=medany -Wl,-evertPbr -o vertPbr.rv64 ./shaders/vertPbr.c maths.c -lm
+riscv64-unknown-elf-objdump -SDls vertPbr.rv64 > vertPbr.dis
+
+riscv64-unknown-elf-gcc -mabi=lp64d -march=rv64imafd_zicsr_zifencei -fPIC -Wall -Wextra -O3 -ffast-math -g -static -nostartfiles -mcmodel=medany -Wl,-efragSkybox -o fragSkybox.rv64 ./shaders/fragSkybox.c maths.c -lm
+riscv64-unknown-elf-objdump -SDls fragSkybox.rv64 > fragSkybox.dis
+riscv64-unknown-elf-gcc -mabi=lp64d -march=rv64imafd_zicsr_zifencei -fPIC -Wall -Wextra -O3 -ffast-math -g -static -nostartfiles -mcmodel=medany -Wl,-evertSkybox -o vertSkybox.rv64 ./shaders/vertSkybox.c maths.c -lm
+riscv64-unknown-elf-objdump -SDls vertSkybox.rv64 > vertSkybox.dis
@@ -0,0 +1,13 @@
+#include <string.h>
+#include "cost.h"
+
+int cost_enabled;
+lane_cost_t hart_costs[PLUGIN_MAX_HARTS];
+
+void cost_publish(lane_cost_t *cost, uint64_t lane)
+{
+    if (!cost_enabled)
+        return;
+    memcpy(PLUGIN_LANE_COST(PLUGIN_BASE_ADDR, lane), cost, sizeof(lane_cost_t));
+    memset(cost, 0, sizeof(lane_cost_t));
+}
@@ -0,0 +1,60 @@
+#ifndef _COST_H
+#define _COST_H
+
+#include <inttypes.h>
+#include "plugin_address.h"
+
+// Nonzero if the host asked for shader costs, read from the control block at startup.
+extern int cost_enabled;
+// Cost of the shaders run by the current command of every hart, published to
+// the cost block of its lane (see lane_cost_t) when the command is done.
+extern lane_cost_t hart_costs[PLUGIN_MAX_HARTS];
+
+typedef struct {
+    uint64_t cycle;
+    uint64_t instret;
+} cost_mark_t;
+
+// Start measuring a shader invocation.
+static inline cost_mark_t cost_begin(void)
+{
+    cost_mark_t mark = { 0, 0 };
+    if (cost_enabled) {
+        __asm__ volatile("csrr %0, mcycle" : "=r"(mark.cycle));
+        __asm__ volatile("csrr %0, minstret" : "=r"(mark.instret));
+    }
+    return mark;
+}
+
+// Add the count invocations started at mark (a call of a batch shader) to
+// cost, binned in the histogram by their average cycles.
+static inline void cost_end_batch(shader_cost_t *cost, cost_mark_t mark, uint64_t count)
+{
+    uint64_t cycle, instret, average;
+    int bucket = 0;
+
+    if (!cost_enabled || count == 0)
+        return;
+    __asm__ volatile("csrr %0, mcycle" : "=r"(cycle));
+    __asm__ volatile("csrr %0, minstret" : "=r"(instret));
+    cycle -= mark.cycle;
+    average = cycle / count;
+    while (bucket < PLUGIN_COST_BUCKETS - 1 && (average >> (bucket + 1)) != 0)
+        ++bucket;
+    cost->invocations += count;
+    cost->cycles += cycle;
+    cost->instret += instret - mark.instret;
+    cost->histogram[bucket] += count;
+}
+
+// Add the invocation started at mark to cost.
+static inline void cost_end(shader_cost_t *cost, cost_mark_t mark)
+{
+    cost_end_batch(cost, mark, 1);
+}
+
+// Write the cost of the command that is done to the cost block of lane and
+// start counting from zero.
+void cost_publish(lane_cost_t *cost, uint64_t lane);
+
+#endif /* _COST_H */
@@ -0,0 +1,178 @@
+#ifndef _FIXED_H
+#define _FIXED_H
+
+#include <stdint.h>
+#include <string.h>
+
+// Q16.16 arithmetic of the fixed-point shaders (see shaders/fragAQ.c). Everything here compiles to integer
+// instructions only, the conversions from and to float work on the bits, so none of it goes through the FP
+// emulation of spike.
+
+typedef int32_t q16_t;
+typedef struct { q16_t x, y; } q16vec2_t;
+typedef struct { q16_t x, y, z; } q16vec3_t;
+typedef struct { q16_t x, y, z, w; } q16vec4_t;
+
+#define Q16_ONE (1 << 16)
+// Constant from a float literal, folded at compile time.
+#define Q16(f) ((q16_t) ((f) * Q16_ONE))
+
+static inline q16_t q16_mul(q16_t a, q16_t b)
+{
+    return (q16_t) (((int64_t) a * b) >> 16);
+}
+
+static inline q16_t q16_div(q16_t a, q16_t b)
+{
+    return (q16_t) (((int64_t) a * Q16_ONE) / b);
+}
+
+static inline q16_t q16_max(q16_t a, q16_t b)
+{
+    return a > b ? a : b;
+}
+
+// Value of the float with the given bits, truncated toward zero and saturated.
+static inline q16_t q16_from_float_bits(uint32_t bits)
+{
+    int exponent = (int) ((bits >> 23) & 0xFF);
+    uint32_t mantissa = (bits & 0x7FFFFF) | 0x800000;
+    int shift = exponent - 127 - 23 + 16;  // value in Q16.16 is mantissa * 2^shift
+    uint32_t magnitude;
+
+    if (exponent == 0)
+        return 0;
+    if (shift >= 8)
+        magnitude = INT32_MAX;
+    else if (shift >= 0)
+        magnitude = mantissa << shift;
+    else if (shift > -24)
+        magnitude = mantissa >> -shift;
+    else
+        magnitude = 0;
+    return bits >> 31 ? -(q16_t) magnitude : (q16_t) magnitude;
+}
+
+static inline float q16_to_float(q16_t q)
+{
+    uint32_t sign = q < 0 ? 0x80000000u : 0;
+    uint32_t magnitude = q < 0 ? -(uint32_t) q : (uint32_t) q;
+    uint32_t bits = 0;
+    float f;
+
+    if (magnitude) {
+        int msb = 31 - __builtin_clz(magnitude);
+        uint32_t mantissa = msb > 23 ? magnitude >> (msb - 23) : magnitude << (23 - msb);
+        bits = sign | (uint32_t) (msb - 16 + 127) << 23 | (mantissa & 0x7FFFFF);
+    }
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+// Square root of a Q32.32 value, such as a sum of products of Q16.16 values, as Q16.16.
+static inline q16_t q16_sqrt_wide(uint64_t x)
+{
+    uint64_t result = 0;
+    uint64_t bit = 1ull << 62;
+
+    while (bit > x)
+        bit >>= 2;
+    while (bit) {
+        if (x >= result + bit) {
+            x -= result + bit;
+            result = (result >> 1) + bit;
+        } else {
+            result >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (q16_t) result;
+}
+
+// log2 of x > 0, the fraction bit by bit by squaring the mantissa.
+static inline q16_t q16_log2(q16_t x)
+{
+    int msb = 31 - __builtin_clz((uint32_t) x);
+    q16_t result = (q16_t) (msb - 16) * Q16_ONE;
+    uint32_t m = msb > 16 ? (uint32_t) x >> (msb - 16) : (uint32_t) x << (16 - msb);
+
+    for (int bit = 15; bit >= 0; --bit) {
+        m = (uint32_t) (((uint64_t) m * m) >> 16);
+        if (m >= 2u << 16) {
+            m >>= 1;
+            result += 1 << bit;
+        }
+    }
+    return result;
+}
+
+// 2^x, with a cubic fit of the fraction (error below 1e-4).
+static inline q16_t q16_exp2(q16_t x)
+{
+    int integer = x >> 16;
+    q16_t f = x & 0xFFFF;
+    q16_t p = Q16_ONE + q16_mul(f, Q16(0.695556856f) + q16_mul(f, Q16(0.226173572f) + q16_mul(f, Q16(0.0781455737f))));
+
+    if (integer >= 15)
+        return INT32_MAX;
+    if (integer < -16)
+        return 0;
+    return integer >= 0 ? p << integer : p >> -integer;
+}
+
+static inline q16_t q16_pow(q16_t x, q16_t e)
+{
+    return x > 0 ? q16_exp2(q16_mul(e, q16_log2(x))) : 0;
+}
+
+static inline q16vec3_t q16vec3_new(q16_t x, q16_t y, q16_t z)
+{
+    q16vec3_t v = { x, y, z };
+    return v;
+}
+
+static inline q16vec3_t q16vec3_add(q16vec3_t a, q16vec3_t b)
+{
+    return q16vec3_new(a.x + b.x, a.y + b.y, a.z + b.z);
+}
+
+static inline q16vec3_t q16vec3_sub(q16vec3_t a, q16vec3_t b)
+{
+    return q16vec3_new(a.x - b.x, a.y - b.y, a.z - b.z);
+}
+
+static inline q16vec3_t q16vec3_negate(q16vec3_t v)
+{
+    return q16vec3_new(-v.x, -v.y, -v.z);
+}
+
+static inline q16vec3_t q16vec3_mul(q16vec3_t v, q16_t factor)
+{
+    return q16vec3_new(q16_mul(v.x, factor), q16_mul(v.y, factor), q16_mul(v.z, factor));
+}
+
+static inline q16vec3_t q16vec3_modulate(q16vec3_t a, q16vec3_t b)
+{
+    return q16vec3_new(q16_mul(a.x, b.x), q16_mul(a.y, b.y), q16_mul(a.z, b.z));
+}
+
+// Dot product in Q32.32, which does not overflow for long vectors.
+static inline int64_t q16vec3_dot_wide(q16vec3_t a, q16vec3_t b)
+{
+    return (int64_t) a.x * b.x + (int64_t) a.y * b.y + (int64_t) a.z * b.z;
+}
+
+static inline q16_t q16vec3_dot(q16vec3_t a, q16vec3_t b)
+{
+    return (q16_t) (q16vec3_dot_wide(a, b) >> 16);
+}
+
+static inline q16vec3_t q16vec3_normalize(q16vec3_t v)
+{
+    q16_t length = q16_sqrt_wide((uint64_t) q16vec3_dot_wide(v, v));
+    if (!length)
+        return v;
+    return q16vec3_new(q16_div(v.x, length), q16_div(v.y, length), q16_div(v.z, length));
+}
+
+#endif /* _FIXED_H */
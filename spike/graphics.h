@@ -33,6 +33,7 @@ struct program {
     vec4_t out_coords[MAX_VARYINGS];
     void *in_varyings[MAX_VARYINGS];
     void *out_varyings[MAX_VARYINGS];
+    int fs_precision;   /* precision_t of the renderer, only used by the host */
 };
 
 #endif /* _GRAPHICS_H */
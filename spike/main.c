@@ -5,47 +5,67 @@
 #include <string.h>
 #include "plugin_address.h"
 #include "graphics.h"
+#include "pipeline.h"
+#include "residency.h"
+#include "cost.h"
+#include "stfb.h"
 
-// Update fbaddr CSR to the given value.
-void update_fbaddr(unsigned char* addr) __attribute__ ((noinline));
-// Draw the given pixel at the specified offset in the framebuffer.
-void draw(uint32_t pixel, ptrdiff_t offset) __attribute__ ((noinline));
+// Run the fragment shader for every job of the fragment ring up to head. If framebuffer is not NULL,
+// surviving fragments are written to it directly instead of being returned as results.
+static void shade_fragments(program_t *program, fs_ring_t *ring, uint64_t head, framebuffer_t *framebuffer,
+                            shader_cost_t *cost);
+// Run the vertex shader for a range of vertices, writing the results to the vertex output stream.
+static void shade_vertices(program_t *program, unsigned char *attribs, uint64_t stride, uint64_t count,
+                           vs_output_t *stream, shader_cost_t *cost);
 
-#define NO_STFB 1
-
-// define this macro to disable usage of stfb instruction
 #ifdef NO_STFB
 static unsigned char* color_buffer = NULL;
+static float* depth_buffer = NULL;
+static uint64_t fb_width = 0;
 #endif
 
-// Loop forever, handling incoming commands
+// Loop forever, handling the commands posted to the mailbox of this hart
 int main(void)
 {
-    send_msg((void*) PLUGIN_BASE_ADDR, PLUGIN_CMD_READY, 0);
+    control_t *control = PLUGIN_CONTROL(PLUGIN_BASE_ADDR);
+    uint64_t hart;
+    __asm__ volatile("csrr %0, mhartid" : "=r"(hart));
+    if (hart >= control->num_harts)
+        return 0;
+
+    uint64_t lane = control->lane_base + hart;
+    mailbox_t *mailbox = PLUGIN_MAILBOX(PLUGIN_BASE_ADDR, lane);
+    lane_cost_t *cost = &hart_costs[hart];
+    uint64_t seen = mailbox->ack;
+    cost_enabled = control->costs != 0;
+    announce_ready((void*) PLUGIN_BASE_ADDR, lane);
     while (true) {
         uint64_t args[5] = { 0 };
         program_t *program = NULL;
-        command_t cmd = recv_msg((void*) PLUGIN_BASE_ADDR, 
-                        PLUGIN_CMD_FBADDR | PLUGIN_CMD_DRAW | PLUGIN_CMD_FS | PLUGIN_CMD_VS | PLUGIN_CMD_STOP,
-                        args);
+        cost_mark_t mark;
+        command_t cmd = recv_msg(mailbox, &seen, args);
         switch (cmd) {
         case PLUGIN_CMD_FBADDR:
             update_fbaddr((unsigned char*) args[0]);
-            send_msg((void*) PLUGIN_BASE_ADDR, PLUGIN_CMD_READY, 0);
+            reply_msg(mailbox, seen, 0);
             break;
         case PLUGIN_CMD_DRAW:
             draw((uint32_t) args[0], (ptrdiff_t) args[1]);
-            send_msg((void*) PLUGIN_BASE_ADDR, PLUGIN_CMD_READY, 0);
+            reply_msg(mailbox, seen, 0);
             break;
         case PLUGIN_CMD_FS:
             program = (program_t*) args[0];
             int discard = (int) args[1];
             int backface = (int) args[2];
+            void *fs_uniforms = resident_uniforms(program);
+            mark = cost_begin();
             vec4_t color = program->fragment_shader(program->shader_varyings,
-                                                    program->shader_uniforms,
+                                                    fs_uniforms,
                                                     &discard,
                                                     backface);
-            send_msg((void*) PLUGIN_BASE_ADDR, PLUGIN_CMD_READY, 5,
+            cost_end(&cost->fragment, mark);
+            cost_publish(cost, lane);
+            reply_msg(mailbox, seen, 5,
                         discard, 
                         * (int32_t*) &color.x, * (int32_t*) &color.y, 
                         * (int32_t*) &color.z, * (int32_t*) &color.w);
@@ -53,19 +73,140 @@ int main(void)
         case PLUGIN_CMD_VS:
             program = (program_t*) args[0];
             int i = (int) args[1];
+            void *vs_uniforms = resident_uniforms(program);
+            mark = cost_begin();
             vec4_t rv = program->vertex_shader(program->shader_attribs[i],
                                                 program->in_varyings[i],
-                                                program->shader_uniforms);
-            send_msg((void*) PLUGIN_BASE_ADDR, PLUGIN_CMD_READY, 4,
+                                                vs_uniforms);
+            cost_end(&cost->vertex, mark);
+            cost_publish(cost, lane);
+            reply_msg(mailbox, seen, 4,
                         * (int32_t*) &rv.x, * (int32_t*) &rv.y, 
                         * (int32_t*) &rv.z, * (int32_t*) &rv.w);
             break;
+        case PLUGIN_CMD_FS_BATCH:
+            program = (program_t*) args[0];
+            shade_fragments(program, (fs_ring_t*) args[2], args[3], (framebuffer_t*) args[1], &cost->fragment);
+            cost_publish(cost, lane);
+            reply_msg(mailbox, seen, 0);
+            break;
+        case PLUGIN_CMD_VS_BATCH:
+            program = (program_t*) args[0];
+            shade_vertices(program, (unsigned char*) args[1], args[2], args[3], (vs_output_t*) args[4],
+                           &cost->vertex);
+            cost_publish(cost, lane);
+            reply_msg(mailbox, seen, 0);
+            break;
+        case PLUGIN_CMD_DRAW_MESH:
+            program = (program_t*) args[0];
+            draw_mesh(program, (unsigned char*) args[1], args[2], args[3], (framebuffer_t*) args[4], cost);
+            cost_publish(cost, lane);
+            reply_msg(mailbox, seen, 0);
+            break;
         case PLUGIN_CMD_STOP:
             return 0;
         }
     }
 }
 
+static void shade_fragments(program_t *program, fs_ring_t *ring, uint64_t head, framebuffer_t *framebuffer,
+                            shader_cost_t *cost)
+{
+    // Every access to the ring and the program is an MMIO access, so read them only once. The head of the
+    // ring is not read, the host may be queueing the next batch behind this one.
+    fragment_shader_t *fragment_shader = program->fragment_shader;
+    fragment_batch_shader_t *fragment_batch = (fragment_batch_shader_t*) PLUGIN_BATCH_SHADERS(program)->fragment;
+    uint64_t tail = ring->tail;
+    draw_state_t state;
+    void *uniforms;
+
+    if (framebuffer) {
+        load_draw_state(&state, program, framebuffer);
+        uniforms = state.uniforms;
+    } else {
+        uniforms = resident_uniforms(program);
+    }
+
+    // A batch shader takes every run of consecutive slots in one call and always writes the results to the ring,
+    // from where the survivors are written to the framebuffer if there is one.
+    while (fragment_batch && tail != head) {
+        uint64_t slot = PLUGIN_FS_RING_SLOT(tail);
+        uint64_t count = head - tail;
+        if (count > PLUGIN_FS_RING_SIZE - slot)
+            count = PLUGIN_FS_RING_SIZE - slot;
+        cost_mark_t mark = cost_begin();
+        fragment_batch(&ring->jobs[slot], &ring->results[slot], count, uniforms);
+        cost_end_batch(cost, mark, count);
+        for (uint64_t i = slot; framebuffer && i < slot + count; ++i) {
+            fs_job_t *job = &ring->jobs[i];
+            fs_result_t *result = &ring->results[i];
+            int index = job->index;
+            float depth = job->depth;
+            if (result->discard || depth > state.depth_buffer[index])
+                continue;
+            vec4_t color = { result->color[0], result->color[1], result->color[2], result->color[3] };
+            write_fragment(&state, index, depth, color);
+        }
+        tail += count;
+    }
+
+    for (; tail != head; ++tail) {
+        fs_job_t *job = &ring->jobs[PLUGIN_FS_RING_SLOT(tail)];
+        int discard = 0;
+        vec4_t color;
+
+        if (framebuffer) {
+            // An earlier fragment of the batch may have covered this pixel since the early depth test.
+            int index = job->index;
+            float depth = job->depth;
+            if (depth > state.depth_buffer[index])
+                continue;
+            cost_mark_t mark = cost_begin();
+            color = fragment_shader(job->varyings, uniforms, &discard, job->backface);
+            cost_end(cost, mark);
+            if (!discard)
+                write_fragment(&state, index, depth, color);
+        } else {
+            fs_result_t *result = &ring->results[PLUGIN_FS_RING_SLOT(tail)];
+            cost_mark_t mark = cost_begin();
+            color = fragment_shader(job->varyings, uniforms, &discard, job->backface);
+            cost_end(cost, mark);
+            result->discard = discard;
+            result->color[0] = color.x;
+            result->color[1] = color.y;
+            result->color[2] = color.z;
+            result->color[3] = color.w;
+        }
+    }
+    ring->tail = tail;
+}
+
+static void shade_vertices(program_t *program, unsigned char *attribs, uint64_t stride, uint64_t count,
+                           vs_output_t *stream, shader_cost_t *cost)
+{
+    vertex_shader_t *vertex_shader = program->vertex_shader;
+    vertex_batch_shader_t *vertex_batch = (vertex_batch_shader_t*) PLUGIN_BATCH_SHADERS(program)->vertex;
+    void *uniforms = resident_uniforms(program);
+
+    if (vertex_batch) {
+        cost_mark_t mark = cost_begin();
+        vertex_batch(attribs, stride, count, stream, uniforms);
+        cost_end_batch(cost, mark, count);
+        return;
+    }
+
+    for (uint64_t i = 0; i < count; ++i) {
+        vs_output_t *output = &stream[i];
+        cost_mark_t mark = cost_begin();
+        vec4_t coord = vertex_shader(attribs + i * stride, output->varyings, uniforms);
+        cost_end(cost, mark);
+        output->coord[0] = coord.x;
+        output->coord[1] = coord.y;
+        output->coord[2] = coord.z;
+        output->coord[3] = coord.w;
+    }
+}
+
 void update_fbaddr(unsigned char* addr)
 {
 #ifndef NO_STFB
@@ -83,3 +224,69 @@ void draw(uint32_t pixel, ptrdiff_t offset)
     memcpy(color_buffer + (4 * offset), &pixel, 4);
 #endif
 }
+
+void update_zbaddr(float* addr)
+{
+#ifndef NO_STFB
+    __asm__ volatile("csrw 0x801, %0" : : "r"(addr));
+#else
+    depth_buffer = addr;
+#endif
+}
+
+int draw_depth(uint32_t pixel, float depth, ptrdiff_t offset)
+{
+#ifndef NO_STFB
+    uint32_t depth_bits;
+    int pass;
+    memcpy(&depth_bits, &depth, sizeof(depth_bits));
+    // use stfbz custom command, rd = (depth <= zb[offset]), then fb[offset] = pixel and zb[offset] = depth
+    __asm__ volatile(".insn r4 0xB, 0x1, 0x0, %0, %1, %2, %3"
+                     : "=r"(pass) : "r"(offset), "r"(pixel), "r"(depth_bits) : "memory");
+    return pass;
+#else
+    if (depth > depth_buffer[offset])
+        return 0;
+    memcpy(color_buffer + (4 * offset), &pixel, 4);
+    depth_buffer[offset] = depth;
+    return 1;
+#endif
+}
+
+void update_fbwidth(uint64_t width)
+{
+#ifndef NO_STFB
+    __asm__ volatile("csrw 0x802, %0" : : "r"(width));
+#else
+    fb_width = width;
+#endif
+}
+
+void draw_span(const uint32_t pixels[4], ptrdiff_t offset, unsigned mask)
+{
+#ifndef NO_STFB
+    uint64_t first = (uint64_t) (uint32_t) offset | (uint64_t) (mask & 0xf) << 32;
+    uint64_t p01 = pixels[0] | (uint64_t) pixels[1] << 32;
+    uint64_t p23 = pixels[2] | (uint64_t) pixels[3] << 32;
+    __asm__ volatile(".insn r4 0xB, 0x2, 0x0, x0, %0, %1, %2" : : "r"(first), "r"(p01), "r"(p23) : "memory");
+#else
+    for (int i = 0; i < 4; ++i)
+        if (mask & (1u << i))
+            memcpy(color_buffer + 4 * (offset + i), &pixels[i], 4);
+#endif
+}
+
+void draw_quad(const uint32_t pixels[4], ptrdiff_t offset, unsigned mask)
+{
+#ifndef NO_STFB
+    uint64_t first = (uint64_t) (uint32_t) offset | (uint64_t) (mask & 0xf) << 32;
+    uint64_t top = pixels[0] | (uint64_t) pixels[1] << 32;
+    uint64_t bottom = pixels[2] | (uint64_t) pixels[3] << 32;
+    __asm__ volatile(".insn r4 0xB, 0x2, 0x1, x0, %0, %1, %2" : : "r"(first), "r"(top), "r"(bottom) : "memory");
+#else
+    ptrdiff_t offsets[4] = { offset, offset + 1, offset + (ptrdiff_t) fb_width, offset + (ptrdiff_t) fb_width + 1 };
+    for (int i = 0; i < 4; ++i)
+        if (mask & (1u << i))
+            memcpy(color_buffer + 4 * offsets[i], &pixels[i], 4);
+#endif
+}
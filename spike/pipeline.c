@@ -0,0 +1,422 @@
+#include <math.h>
+#include <string.h>
+#include "plugin_address.h"
+#include "macro.h"
+#include "maths.h"
+#include "pipeline.h"
+#include "residency.h"
+#include "cost.h"
+#include "stfb.h"
+
+/*
+ * guest side copy of the graphics pipeline of the renderer (see
+ * renderer/renderer/core/graphics.c), everything that lives in shared memory
+ * is an MMIO access, so the program and the framebuffer are read only once
+ * per draw call and varyings are kept on the stack of the hart
+ */
+
+typedef float varyings_t[PLUGIN_MAX_VARYING_FLOATS];
+
+/* triangle clipping */
+
+typedef enum {
+    POSITIVE_W,
+    POSITIVE_X,
+    NEGATIVE_X,
+    POSITIVE_Y,
+    NEGATIVE_Y,
+    POSITIVE_Z,
+    NEGATIVE_Z
+} plane_t;
+
+static int is_inside_plane(vec4_t coord, plane_t plane) {
+    switch (plane) {
+        case POSITIVE_W:
+            return coord.w >= EPSILON;
+        case POSITIVE_X:
+            return coord.x <= +coord.w;
+        case NEGATIVE_X:
+            return coord.x >= -coord.w;
+        case POSITIVE_Y:
+            return coord.y <= +coord.w;
+        case NEGATIVE_Y:
+            return coord.y >= -coord.w;
+        case POSITIVE_Z:
+            return coord.z <= +coord.w;
+        case NEGATIVE_Z:
+            return coord.z >= -coord.w;
+        default:
+            return 0;
+    }
+}
+
+static float get_intersect_ratio(vec4_t prev, vec4_t curr, plane_t plane) {
+    switch (plane) {
+        case POSITIVE_W:
+            return (prev.w - EPSILON) / (prev.w - curr.w);
+        case POSITIVE_X:
+            return (prev.w - prev.x) / ((prev.w - prev.x) - (curr.w - curr.x));
+        case NEGATIVE_X:
+            return (prev.w + prev.x) / ((prev.w + prev.x) - (curr.w + curr.x));
+        case POSITIVE_Y:
+            return (prev.w - prev.y) / ((prev.w - prev.y) - (curr.w - curr.y));
+        case NEGATIVE_Y:
+            return (prev.w + prev.y) / ((prev.w + prev.y) - (curr.w + curr.y));
+        case POSITIVE_Z:
+            return (prev.w - prev.z) / ((prev.w - prev.z) - (curr.w - curr.z));
+        case NEGATIVE_Z:
+            return (prev.w + prev.z) / ((prev.w + prev.z) - (curr.w + curr.z));
+        default:
+            return 0;
+    }
+}
+
+static int clip_against_plane(
+        plane_t plane, int in_num_vertices, int varying_num_floats,
+        vec4_t in_coords[MAX_VARYINGS], float in_varyings[][PLUGIN_MAX_VARYING_FLOATS],
+        vec4_t out_coords[MAX_VARYINGS], float out_varyings[][PLUGIN_MAX_VARYING_FLOATS]) {
+    int out_num_vertices = 0;
+    int i, j;
+
+    for (i = 0; i < in_num_vertices; i++) {
+        int prev_index = (i - 1 + in_num_vertices) % in_num_vertices;
+        int curr_index = i;
+        vec4_t prev_coord = in_coords[prev_index];
+        vec4_t curr_coord = in_coords[curr_index];
+        float *prev_varyings = in_varyings[prev_index];
+        float *curr_varyings = in_varyings[curr_index];
+        int prev_inside = is_inside_plane(prev_coord, plane);
+        int curr_inside = is_inside_plane(curr_coord, plane);
+
+        if (prev_inside != curr_inside) {
+            float *dest_varyings = out_varyings[out_num_vertices];
+            float ratio = get_intersect_ratio(prev_coord, curr_coord, plane);
+
+            out_coords[out_num_vertices] = vec4_lerp(prev_coord, curr_coord, ratio);
+            for (j = 0; j < varying_num_floats; j++) {
+                dest_varyings[j] = float_lerp(prev_varyings[j],
+                                              curr_varyings[j],
+                                              ratio);
+            }
+            out_num_vertices += 1;
+        }
+
+        if (curr_inside) {
+            out_coords[out_num_vertices] = curr_coord;
+            memcpy(out_varyings[out_num_vertices], curr_varyings,
+                   varying_num_floats * sizeof(float));
+            out_num_vertices += 1;
+        }
+    }
+    return out_num_vertices;
+}
+
+#define CLIP_IN2OUT(plane)                                                  \
+    do {                                                                    \
+        num_vertices = clip_against_plane(                                  \
+            plane, num_vertices, varying_num_floats,                        \
+            in_coords, in_varyings, out_coords, out_varyings);              \
+        if (num_vertices < 3) {                                             \
+            return 0;                                                       \
+        }                                                                   \
+    } while (0)
+
+#define CLIP_OUT2IN(plane)                                                  \
+    do {                                                                    \
+        num_vertices = clip_against_plane(                                  \
+            plane, num_vertices, varying_num_floats,                        \
+            out_coords, out_varyings, in_coords, in_varyings);              \
+        if (num_vertices < 3) {                                             \
+            return 0;                                                       \
+        }                                                                   \
+    } while (0)
+
+static int is_vertex_visible(vec4_t v) {
+    return fabsf(v.x) <= v.w && fabsf(v.y) <= v.w && fabsf(v.z) <= v.w;
+}
+
+/* clips the triangle in in_coords/in_varyings to out_coords/out_varyings */
+static int clip_triangle(int sizeof_varyings,
+                         vec4_t in_coords[MAX_VARYINGS], varyings_t in_varyings[MAX_VARYINGS],
+                         vec4_t out_coords[MAX_VARYINGS], varyings_t out_varyings[MAX_VARYINGS]) {
+    int v0_visible = is_vertex_visible(in_coords[0]);
+    int v1_visible = is_vertex_visible(in_coords[1]);
+    int v2_visible = is_vertex_visible(in_coords[2]);
+    if (v0_visible && v1_visible && v2_visible) {
+        out_coords[0] = in_coords[0];
+        out_coords[1] = in_coords[1];
+        out_coords[2] = in_coords[2];
+        memcpy(out_varyings[0], in_varyings[0], sizeof_varyings);
+        memcpy(out_varyings[1], in_varyings[1], sizeof_varyings);
+        memcpy(out_varyings[2], in_varyings[2], sizeof_varyings);
+        return 3;
+    } else {
+        int varying_num_floats = sizeof_varyings / sizeof(float);
+        int num_vertices = 3;
+        CLIP_IN2OUT(POSITIVE_W);
+        CLIP_OUT2IN(POSITIVE_X);
+        CLIP_IN2OUT(NEGATIVE_X);
+        CLIP_OUT2IN(POSITIVE_Y);
+        CLIP_IN2OUT(NEGATIVE_Y);
+        CLIP_OUT2IN(POSITIVE_Z);
+        CLIP_IN2OUT(NEGATIVE_Z);
+        return num_vertices;
+    }
+}
+
+/* rasterization */
+
+static int is_back_facing(vec3_t ndc_coords[3]) {
+    vec3_t a = ndc_coords[0];
+    vec3_t b = ndc_coords[1];
+    vec3_t c = ndc_coords[2];
+    float signed_area = a.x * b.y - a.y * b.x +
+                        b.x * c.y - b.y * c.x +
+                        c.x * a.y - c.y * a.x;
+    return signed_area <= 0;
+}
+
+static vec3_t viewport_transform(int width, int height, vec3_t ndc_coord) {
+    float x = (ndc_coord.x + 1) * 0.5f * (float)width;   /* [-1, 1] -> [0, w] */
+    float y = (ndc_coord.y + 1) * 0.5f * (float)height;  /* [-1, 1] -> [0, h] */
+    float z = (ndc_coord.z + 1) * 0.5f;                  /* [-1, 1] -> [0, 1] */
+    return vec3_new(x, y, z);
+}
+
+typedef struct {int min_x, min_y, max_x, max_y;} bbox_t;
+
+static int min_integer(int a, int b) {
+    return a < b ? a : b;
+}
+
+static int max_integer(int a, int b) {
+    return a > b ? a : b;
+}
+
+static bbox_t find_bounding_box(vec2_t abc[3], int width, int height) {
+    vec2_t min = vec2_min(vec2_min(abc[0], abc[1]), abc[2]);
+    vec2_t max = vec2_max(vec2_max(abc[0], abc[1]), abc[2]);
+    bbox_t bbox;
+    bbox.min_x = max_integer((int)floorf(min.x), 0);
+    bbox.min_y = max_integer((int)floorf(min.y), 0);
+    bbox.max_x = min_integer((int)ceilf(max.x), width - 1);
+    bbox.max_y = min_integer((int)ceilf(max.y), height - 1);
+    return bbox;
+}
+
+static vec3_t calculate_weights(vec2_t abc[3], vec2_t p) {
+    vec2_t a = abc[0];
+    vec2_t b = abc[1];
+    vec2_t c = abc[2];
+    vec2_t ab = vec2_sub(b, a);
+    vec2_t ac = vec2_sub(c, a);
+    vec2_t ap = vec2_sub(p, a);
+    float factor = 1 / (ab.x * ac.y - ab.y * ac.x);
+    float s = (ac.y * ap.x - ac.x * ap.y) * factor;
+    float t = (ab.x * ap.y - ab.y * ap.x) * factor;
+    return vec3_new(1 - s - t, s, t);
+}
+
+static float interpolate_depth(float screen_depths[3], vec3_t weights) {
+    float depth0 = screen_depths[0] * weights.x;
+    float depth1 = screen_depths[1] * weights.y;
+    float depth2 = screen_depths[2] * weights.z;
+    return depth0 + depth1 + depth2;
+}
+
+static void interpolate_varyings(float *src_varyings[3], float *dst,
+                                 int sizeof_varyings, vec3_t weights,
+                                 float recip_w[3]) {
+    int num_floats = sizeof_varyings / sizeof(float);
+    float *src0 = src_varyings[0];
+    float *src1 = src_varyings[1];
+    float *src2 = src_varyings[2];
+    float weight0 = recip_w[0] * weights.x;
+    float weight1 = recip_w[1] * weights.y;
+    float weight2 = recip_w[2] * weights.z;
+    float normalizer = 1 / (weight0 + weight1 + weight2);
+    int i;
+    for (i = 0; i < num_floats; i++) {
+        float sum = src0[i] * weight0 + src1[i] * weight1 + src2[i] * weight2;
+        dst[i] = sum * normalizer;
+    }
+}
+
+void load_draw_state(draw_state_t *state, program_t *program,
+                     framebuffer_t *framebuffer) {
+    state->vertex_shader = program->vertex_shader;
+    state->fragment_shader = program->fragment_shader;
+    state->uniforms = resident_uniforms(program);
+    state->sizeof_varyings = program->sizeof_varyings;
+    state->double_sided = program->double_sided;
+    state->enable_blend = program->enable_blend;
+    state->width = framebuffer->width;
+    state->height = framebuffer->height;
+    state->color_buffer = (uint32_t*) framebuffer->color_buffer;
+    state->depth_buffer = framebuffer->depth_buffer;
+    state->num_lanes = (int) PLUGIN_CONTROL(PLUGIN_BASE_ADDR)->num_lanes;
+    __asm__ volatile("csrr %0, mhartid" : "=r"(state->lane));
+    state->lane += (int) PLUGIN_CONTROL(PLUGIN_BASE_ADDR)->lane_base;
+    state->cost = NULL;
+#ifndef NO_STFB
+    update_fbaddr(framebuffer->color_buffer);
+    update_zbaddr(framebuffer->depth_buffer);
+    update_fbwidth(framebuffer->width);
+#endif
+}
+
+/* same packing as the host, alpha is left at zero */
+void write_fragment(const draw_state_t *state, int index, float depth,
+                    vec4_t color) {
+    uint32_t pixel;
+
+    color = vec4_saturate(color);
+    if (state->enable_blend) {
+        /* out_color = src_color * src_alpha + dst_color * (1 - src_alpha) */
+        uint32_t dst = state->color_buffer[index];
+        float dst_r = float_from_uchar((unsigned char)(dst >> 0));
+        float dst_g = float_from_uchar((unsigned char)(dst >> 8));
+        float dst_b = float_from_uchar((unsigned char)(dst >> 16));
+        color.x = color.x * color.w + dst_r * (1 - color.w);
+        color.y = color.y * color.w + dst_g * (1 - color.w);
+        color.z = color.z * color.w + dst_b * (1 - color.w);
+    }
+
+    pixel = (uint32_t)float_to_uchar(color.x)
+          | (uint32_t)float_to_uchar(color.y) << 8
+          | (uint32_t)float_to_uchar(color.z) << 16;
+#ifndef NO_STFB
+    /* depth test and both writes in one stfbz */
+    draw_depth(pixel, depth, index);
+#else
+    state->color_buffer[index] = pixel;
+    state->depth_buffer[index] = depth;
+#endif
+}
+
+static int rasterize_triangle(const draw_state_t *state, vec4_t clip_coords[3],
+                              float *varyings[3]) {
+    int width = state->width;
+    int height = state->height;
+    vec3_t ndc_coords[3];
+    vec2_t screen_coords[3];
+    float screen_depths[3];
+    float recip_w[3];
+    varyings_t fragment_varyings;
+    int backface;
+    bbox_t bbox;
+    int i, x, y;
+
+    /* perspective division */
+    for (i = 0; i < 3; i++) {
+        vec3_t clip_coord = vec3_from_vec4(clip_coords[i]);
+        ndc_coords[i] = vec3_div(clip_coord, clip_coords[i].w);
+    }
+
+    /* back-face culling */
+    backface = is_back_facing(ndc_coords);
+    if (backface && !state->double_sided) {
+        return 1;
+    }
+
+    /* reciprocals of w */
+    for (i = 0; i < 3; i++) {
+        recip_w[i] = 1 / clip_coords[i].w;
+    }
+
+    /* viewport mapping */
+    for (i = 0; i < 3; i++) {
+        vec3_t window_coord = viewport_transform(width, height, ndc_coords[i]);
+        screen_coords[i] = vec2_new(window_coord.x, window_coord.y);
+        screen_depths[i] = window_coord.z;
+    }
+
+    /* perform rasterization, skipping the tiles owned by other lanes */
+    bbox = find_bounding_box(screen_coords, width, height);
+    for (x = bbox.min_x; x <= bbox.max_x; x++) {
+        for (y = bbox.min_y; y <= bbox.max_y; y++) {
+            vec2_t point;
+            vec3_t weights;
+            int weight0_okay, weight1_okay, weight2_okay;
+            if (PLUGIN_TILE_LANE(x, y, state->num_lanes) != state->lane) {
+                continue;
+            }
+            point = vec2_new((float)x + 0.5f, (float)y + 0.5f);
+            weights = calculate_weights(screen_coords, point);
+            weight0_okay = weights.x > -EPSILON;
+            weight1_okay = weights.y > -EPSILON;
+            weight2_okay = weights.z > -EPSILON;
+            if (weight0_okay && weight1_okay && weight2_okay) {
+                int index = y * width + x;
+                float depth = interpolate_depth(screen_depths, weights);
+                /* early depth testing */
+                if (depth <= state->depth_buffer[index]) {
+                    int discard = 0;
+                    vec4_t color;
+                    cost_mark_t mark;
+                    interpolate_varyings(varyings, fragment_varyings,
+                                         state->sizeof_varyings,
+                                         weights, recip_w);
+                    mark = cost_begin();
+                    color = state->fragment_shader(fragment_varyings,
+                                                   state->uniforms,
+                                                   &discard, backface);
+                    cost_end(&state->cost->fragment, mark);
+                    if (!discard) {
+                        write_fragment(state, index, depth, color);
+                    }
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+void draw_mesh(program_t *program, unsigned char *vertices, uint64_t stride, uint64_t count,
+               framebuffer_t *framebuffer, lane_cost_t *cost)
+{
+    draw_state_t state;
+    vec4_t in_coords[MAX_VARYINGS];
+    vec4_t out_coords[MAX_VARYINGS];
+    varyings_t in_varyings[MAX_VARYINGS];
+    varyings_t out_varyings[MAX_VARYINGS];
+    uint64_t first;
+    int i;
+
+    load_draw_state(&state, program, framebuffer);
+    state.cost = cost;
+
+    for (first = 0; first + 3 <= count; first += 3) {
+        int num_vertices;
+
+        /* execute vertex shader */
+        for (i = 0; i < 3; i++) {
+            cost_mark_t mark = cost_begin();
+            in_coords[i] = state.vertex_shader(vertices + (first + i) * stride,
+                                               in_varyings[i], state.uniforms);
+            cost_end(&state.cost->vertex, mark);
+        }
+
+        /* triangle clipping */
+        num_vertices = clip_triangle(state.sizeof_varyings, in_coords, in_varyings,
+                                     out_coords, out_varyings);
+
+        /* triangle assembly */
+        for (i = 0; i < num_vertices - 2; i++) {
+            vec4_t clip_coords[3];
+            float *varyings[3];
+
+            clip_coords[0] = out_coords[0];
+            clip_coords[1] = out_coords[i + 1];
+            clip_coords[2] = out_coords[i + 2];
+            varyings[0] = out_varyings[0];
+            varyings[1] = out_varyings[i + 1];
+            varyings[2] = out_varyings[i + 2];
+
+            if (rasterize_triangle(&state, clip_coords, varyings)) {
+                break;
+            }
+        }
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef _PIPELINE_H
+#define _PIPELINE_H
+
+#include <inttypes.h>
+#include "graphics.h"
+#include "plugin_address.h"
+
+// Fields of the program and the framebuffer used by the pipeline. Both live in
+// shared memory, so they are read once per command.
+typedef struct {
+    vertex_shader_t *vertex_shader;
+    fragment_shader_t *fragment_shader;
+    void *uniforms;
+    int sizeof_varyings;
+    int double_sided;
+    int enable_blend;
+    int width, height;
+    uint32_t *color_buffer;
+    float *depth_buffer;
+    int lane, num_lanes;    // only tiles with PLUGIN_TILE_LANE == lane are rasterized
+    lane_cost_t *cost;      // cost of the shaders run by draw_mesh
+} draw_state_t;
+
+void load_draw_state(draw_state_t *state, program_t *program, framebuffer_t *framebuffer);
+
+// Blend the shaded color with the framebuffer (if enabled for the program)
+// and write the packed pixel and its depth. Without NO_STFB this is a single
+// stfbz, which repeats the depth test.
+void write_fragment(const draw_state_t *state, int index, float depth, vec4_t color);
+
+// Run the whole graphics pipeline (vertex shading, clipping, rasterization,
+// depth test, fragment shading, blending and framebuffer write) for count
+// vertices starting at vertices, stride bytes apart. Every three vertices
+// form a triangle. The cost of the shaders is added to cost.
+void draw_mesh(program_t *program, unsigned char *vertices, uint64_t stride, uint64_t count,
+               framebuffer_t *framebuffer, lane_cost_t *cost);
+
+#endif /* _PIPELINE_H */
@@ -0,0 +1,166 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#include "plugin_address.h"
+#include "residency.h"
+
+#define MAX_UNIFORMS_SIZE   2048 // Largest uniforms struct copied to the memory of a hart.
+#define MAX_CACHED_TEXTURES 64
+
+// Same layout as texture_t of the renderer and the shaders.
+typedef struct {
+    int width, height;
+    vec4_t *buffer;
+} texture_t;
+
+// Copy of a texture in the texture cache. Entries are shared by all harts of
+// this spike process and only touched with cache_lock held.
+typedef struct {
+    texture_t *image;           // texture image in shared memory, NULL if the entry is free
+    uint64_t version;           // version of the image when it was copied
+    uint64_t last_use;          // epoch of the last command using the copy
+    unsigned char *start, *end; // texels in the texture cache
+    texture_t texture;          // texture pointing to the copied texels
+} cached_texture_t;
+
+// Uniforms of the last program run by a hart, with its textures patched.
+typedef struct {
+    program_t *program;
+    uint64_t generation;
+    unsigned char data[MAX_UNIFORMS_SIZE] __attribute__((aligned(16)));
+} hart_uniforms_t;
+
+extern unsigned char _stexcache[], _etexcache[]; // see ls.ld
+
+static cached_texture_t cache[MAX_CACHED_TEXTURES];
+static hart_uniforms_t hart_uniforms[PLUGIN_MAX_HARTS];
+static volatile int cache_lock;
+
+// Lowest free range of size bytes in the texture cache, NULL if there is none.
+static unsigned char *find_space(uint64_t size)
+{
+    unsigned char *start = _stexcache;
+    bool moved = true;
+
+    // Move past every copy overlapping the range until none does.
+    while (moved) {
+        moved = false;
+        for (int i = 0; i < MAX_CACHED_TEXTURES; ++i) {
+            if (cache[i].image && cache[i].start < start + size && cache[i].end > start) {
+                start = cache[i].end;
+                moved = true;
+            }
+        }
+    }
+    return (uint64_t) (_etexcache - start) >= size ? start : NULL;
+}
+
+static cached_texture_t *find_free_entry(void)
+{
+    for (int i = 0; i < MAX_CACHED_TEXTURES; ++i) {
+        if (!cache[i].image)
+            return &cache[i];
+    }
+    return NULL;
+}
+
+// Drop the least recently used copy that is not used by the current command.
+// Returns false if there is none.
+static bool evict(uint64_t epoch)
+{
+    cached_texture_t *victim = NULL;
+
+    for (int i = 0; i < MAX_CACHED_TEXTURES; ++i) {
+        if (cache[i].image && cache[i].last_use < epoch && (!victim || cache[i].last_use < victim->last_use))
+            victim = &cache[i];
+    }
+    if (!victim)
+        return false;
+    victim->image = NULL;
+    return true;
+}
+
+// Copy of the given version of a texture image, made if there is none yet.
+// Returns NULL if it does not fit in the texture cache.
+static texture_t *make_resident(texture_t *image, uint64_t version, uint64_t epoch)
+{
+    cached_texture_t *entry;
+    unsigned char *start;
+
+    for (int i = 0; i < MAX_CACHED_TEXTURES; ++i) {
+        if (cache[i].image != image)
+            continue;
+        if (cache[i].version == version) {
+            cache[i].last_use = epoch;
+            return &cache[i].texture;
+        }
+        // Versions only change between commands, so no hart uses the old copy anymore.
+        cache[i].image = NULL;
+    }
+
+    int width = image->width;
+    int height = image->height;
+    vec4_t *buffer = image->buffer;
+    uint64_t size = (uint64_t) width * height * sizeof(vec4_t);
+    if (size > (uint64_t) (_etexcache - _stexcache))
+        return NULL;
+
+    for (;;) {
+        entry = find_free_entry();
+        start = find_space(size);
+        if (entry && start)
+            break;
+        if (!evict(epoch))
+            return NULL;
+    }
+
+    memcpy(start, buffer, size);
+    entry->image = image;
+    entry->version = version;
+    entry->last_use = epoch;
+    entry->start = start;
+    entry->end = start + size;
+    entry->texture.width = width;
+    entry->texture.height = height;
+    entry->texture.buffer = (vec4_t*) start;
+    return &entry->texture;
+}
+
+void *resident_uniforms(program_t *program)
+{
+    // The residency list follows the program image, see residency_t.
+    residency_t *residency = (residency_t*) (program + 1);
+    void *uniforms = program->shader_uniforms;
+    uint64_t size = residency->sizeof_uniforms;
+    uint64_t hart;
+
+    if (size == 0 || size > MAX_UNIFORMS_SIZE)
+        return uniforms;
+
+    __asm__ volatile("csrr %0, mhartid" : "=r"(hart));
+    hart_uniforms_t *copy = &hart_uniforms[hart];
+    uint64_t generation = residency->generation;
+    uint64_t epoch = residency->epoch;
+    uint64_t num_textures = residency->num_textures;
+
+    if (copy->program != program || copy->generation != generation) {
+        memcpy(copy->data, uniforms, size);
+        copy->program = program;
+        copy->generation = generation;
+    }
+
+    // Texture pointers are patched for every command, since another program may have evicted a copy in the meantime.
+    while (__sync_lock_test_and_set(&cache_lock, 1)) { /* wait for the other harts */ }
+    for (uint64_t i = 0; i < num_textures; ++i) {
+        uint64_t offset = residency->textures[i].offset;
+        uint64_t version = residency->textures[i].version;
+        texture_t *image = *(texture_t**) ((unsigned char*) uniforms + offset);
+        texture_t *texture = make_resident(image, version, epoch);
+        if (!texture)
+            texture = image;
+        memcpy(copy->data + offset, &texture, sizeof(texture));
+    }
+    __sync_lock_release(&cache_lock);
+
+    return copy->data;
+}
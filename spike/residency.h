@@ -0,0 +1,14 @@
+#ifndef _RESIDENCY_H
+#define _RESIDENCY_H
+
+#include "graphics.h"
+
+// Uniforms to pass to the shaders of program. With the plugin option
+// textures=guest, this is a copy of the uniforms in the memory of this hart,
+// where every texture in the residency list of the program points to a copy in
+// the texture cache (see ls.ld), so that neither the uniforms nor the texels
+// are read through the MMIO plugin. Textures that do not fit in the cache, and
+// every texture when the option is not set, are still read from shared memory.
+void *resident_uniforms(program_t *program);
+
+#endif /* _RESIDENCY_H */
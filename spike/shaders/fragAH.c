@@ -0,0 +1,318 @@
+#include <math.h>
+#include <inttypes.h>
+#include "../maths.h"
+#include "../tex.h"
+
+// Half precision variant of fragA, loaded with the plugin option
+// precision=half and built for Zfh. The host converts the varyings and the
+// lighting uniforms to binary16 (see convert_varyings in graphics.c and
+// blinn_half_t). Texel addresses are still computed in float, like fragA, and
+// so is the power of the specular term, everything else runs in half.
+
+typedef _Float16 half_t;
+typedef struct {half_t x, y;} hvec2_t;
+typedef struct {half_t x, y, z;} hvec3_t;
+typedef struct {half_t x, y, z, w;} hvec4_t;
+
+static hvec3_t hvec3_new(half_t x, half_t y, half_t z) {
+    hvec3_t v = {x, y, z};
+    return v;
+}
+
+static hvec3_t hvec3_add(hvec3_t a, hvec3_t b) {
+    return hvec3_new(a.x + b.x, a.y + b.y, a.z + b.z);
+}
+
+static hvec3_t hvec3_sub(hvec3_t a, hvec3_t b) {
+    return hvec3_new(a.x - b.x, a.y - b.y, a.z - b.z);
+}
+
+static hvec3_t hvec3_negate(hvec3_t v) {
+    return hvec3_new(-v.x, -v.y, -v.z);
+}
+
+static hvec3_t hvec3_mul(hvec3_t v, half_t factor) {
+    return hvec3_new(v.x * factor, v.y * factor, v.z * factor);
+}
+
+static hvec3_t hvec3_modulate(hvec3_t a, hvec3_t b) {
+    return hvec3_new(a.x * b.x, a.y * b.y, a.z * b.z);
+}
+
+static half_t hvec3_dot(hvec3_t a, hvec3_t b) {
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+static half_t half_sqrt(half_t h) {
+    half_t root;
+    __asm__("fsqrt.h %0, %1" : "=f"(root) : "f"(h));
+    return root;
+}
+
+static half_t half_abs(half_t h) {
+    return h < 0 ? -h : h;
+}
+
+/* scaled down first, the squared length of a position overflows a half */
+static hvec3_t hvec3_normalize(hvec3_t v) {
+    half_t scale = half_abs(v.x);
+    half_t length;
+    if (half_abs(v.y) > scale) {
+        scale = half_abs(v.y);
+    }
+    if (half_abs(v.z) > scale) {
+        scale = half_abs(v.z);
+    }
+    if (scale == 0) {
+        return v;
+    }
+    v = hvec3_new(v.x / scale, v.y / scale, v.z / scale);
+    length = half_sqrt(hvec3_dot(v, v));
+    return hvec3_new(v.x / length, v.y / length, v.z / length);
+}
+
+static hvec3_t hvec3_from_hvec4(hvec4_t v) {
+    return hvec3_new(v.x, v.y, v.z);
+}
+
+typedef struct {
+    int width, height;
+    vec4_t *buffer;
+} texture_t;
+
+static hvec4_t texture_repeat_sample(texture_t *texture, hvec2_t coord) {
+    vec2_t texcoord = vec2_new((float)coord.x, (float)coord.y);
+    vec4_t texel;
+    hvec4_t h;
+#ifndef NO_TEX
+    texel = *tex_repeat(texture, texcoord);
+#else
+    float u = texcoord.x - floorf(texcoord.x);
+    float v = texcoord.y - floorf(texcoord.y);
+    int c = (int)((texture->width - 1) * u);
+    int r = (int)((texture->height - 1) * v);
+    int index = r * texture->width + c;
+    texel = texture->buffer[index];
+#endif
+    h.x = (half_t)texel.x;
+    h.y = (half_t)texel.y;
+    h.z = (half_t)texel.z;
+    h.w = (half_t)texel.w;
+    return h;
+}
+
+static hvec4_t texture_sample(texture_t *texture, hvec2_t texcoord) {
+    return texture_repeat_sample(texture, texcoord);
+}
+
+// End texture
+
+typedef struct {
+    hvec3_t diffuse;
+    hvec3_t specular;
+    half_t alpha;
+    half_t shininess;
+    hvec3_t normal;
+    hvec3_t emission;
+} material_t;
+
+// blinn_varyings_t of the host, every float converted to a half.
+typedef struct {
+    hvec3_t world_position;
+    hvec3_t depth_position;
+    hvec2_t texcoord;
+    hvec3_t normal;
+} blinn_varyings_t;
+
+typedef struct {
+    hvec3_t light_dir;
+    hvec3_t camera_pos;
+    hvec4_t basecolor;
+    half_t ambient_intensity;
+    half_t punctual_intensity;
+    half_t shininess;
+    half_t alpha_cutoff;
+} blinn_half_t;
+
+typedef struct {
+    vec3_t light_dir;
+    vec3_t camera_pos;
+    mat4_t model_matrix;
+    mat3_t normal_matrix;
+    mat4_t light_vp_matrix;
+    mat4_t camera_vp_matrix;
+    mat4_t *joint_matrices;
+    mat3_t *joint_n_matrices;
+    float ambient_intensity;
+    float punctual_intensity;
+    texture_t *shadow_map;
+    /* surface parameters */
+    vec4_t basecolor;
+    float shininess;
+    texture_t *diffuse_map;
+    texture_t *specular_map;
+    texture_t *emission_map;
+    /* render controls */
+    float alpha_cutoff;
+    int shadow_pass;
+    /* lower precision copies */
+    int32_t fixed[14];  /* blinn_fixed_t, unused here */
+    blinn_half_t half;
+} blinn_uniforms_t;
+
+static int is_zero_vector(hvec3_t v) {
+    return v.x == 0 && v.y == 0 && v.z == 0;
+}
+
+static int is_in_shadow(blinn_varyings_t *varyings,
+                        blinn_uniforms_t *uniforms,
+                        half_t n_dot_l) {
+    if (uniforms->shadow_map) {
+        half_t u = (varyings->depth_position.x + 1) * (half_t)0.5f;
+        half_t v = (varyings->depth_position.y + 1) * (half_t)0.5f;
+        half_t d = (varyings->depth_position.z + 1) * (half_t)0.5f;
+
+        half_t depth_bias = (half_t)0.05f * (1 - n_dot_l);
+        half_t current_depth;
+        hvec2_t texcoord = {u, v};
+        half_t closest_depth;
+
+        if (depth_bias < (half_t)0.005f) {
+            depth_bias = (half_t)0.005f;
+        }
+        current_depth = d - depth_bias;
+        closest_depth = texture_sample(uniforms->shadow_map, texcoord).x;
+
+        return current_depth > closest_depth;
+    } else {
+        return 0;
+    }
+}
+
+static hvec3_t get_view_dir(blinn_varyings_t *varyings,
+                            blinn_uniforms_t *uniforms) {
+    hvec3_t camera_pos = uniforms->half.camera_pos;
+    hvec3_t world_pos = varyings->world_position;
+    return hvec3_normalize(hvec3_sub(camera_pos, world_pos));
+}
+
+static hvec3_t get_specular(hvec3_t light_dir, hvec3_t view_dir,
+                            material_t material) {
+    if (!is_zero_vector(material.specular)) {
+        hvec3_t half_dir = hvec3_normalize(hvec3_add(light_dir, view_dir));
+        half_t n_dot_h = hvec3_dot(material.normal, half_dir);
+        if (n_dot_h > 0) {
+            half_t strength = (half_t)powf((float)n_dot_h, (float)material.shininess);
+            return hvec3_mul(material.specular, strength);
+        }
+    }
+    return hvec3_new(0, 0, 0);
+}
+
+static material_t get_material(blinn_varyings_t *varyings,
+                               blinn_uniforms_t *uniforms,
+                               int backface) {
+    hvec2_t texcoord = varyings->texcoord;
+    hvec3_t diffuse, specular, normal, emission;
+    half_t alpha, shininess;
+    material_t material;
+
+    diffuse = hvec3_from_hvec4(uniforms->half.basecolor);
+    alpha = uniforms->half.basecolor.w;
+    if (uniforms->diffuse_map) {
+        hvec4_t sample = texture_sample(uniforms->diffuse_map, texcoord);
+        diffuse = hvec3_modulate(diffuse, hvec3_from_hvec4(sample));
+        alpha *= sample.w;
+    }
+
+    specular = hvec3_new(0, 0, 0);
+    if (uniforms->specular_map) {
+        hvec4_t sample = texture_sample(uniforms->specular_map, texcoord);
+        specular = hvec3_from_hvec4(sample);
+    }
+    shininess = uniforms->half.shininess;
+
+    normal = hvec3_normalize(varyings->normal);
+    if (backface) {
+        normal = hvec3_negate(normal);
+    }
+
+    emission = hvec3_new(0, 0, 0);
+    if (uniforms->emission_map) {
+        hvec4_t sample = texture_sample(uniforms->emission_map, texcoord);
+        emission = hvec3_from_hvec4(sample);
+    }
+
+    material.diffuse = diffuse;
+    material.specular = specular;
+    material.alpha = alpha;
+    material.shininess = shininess;
+    material.normal = normal;
+    material.emission = emission;
+    return material;
+}
+
+static vec4_t shadow_fragment_shader(blinn_varyings_t *varyings,
+                                     blinn_uniforms_t *uniforms,
+                                     int *discard) {
+    half_t alpha_cutoff = uniforms->half.alpha_cutoff;
+    if (alpha_cutoff > 0) {
+        half_t alpha = uniforms->half.basecolor.w;
+        if (uniforms->diffuse_map) {
+            hvec2_t texcoord = varyings->texcoord;
+            alpha *= texture_sample(uniforms->diffuse_map, texcoord).w;
+        }
+        if (alpha < alpha_cutoff) {
+            *discard = 1;
+        }
+    }
+    return vec4_new(0, 0, 0, 0);
+}
+
+static vec4_t common_fragment_shader(blinn_varyings_t *varyings,
+                                     blinn_uniforms_t *uniforms,
+                                     int *discard,
+                                     int backface) {
+    material_t material = get_material(varyings, uniforms, backface);
+    half_t alpha_cutoff = uniforms->half.alpha_cutoff;
+    if (alpha_cutoff > 0 && material.alpha < alpha_cutoff) {
+        *discard = 1;
+        return vec4_new(0, 0, 0, 0);
+    } else {
+        hvec3_t color = material.emission;
+
+        if (uniforms->half.ambient_intensity > 0) {
+            hvec3_t ambient = material.diffuse;
+            half_t intensity = uniforms->half.ambient_intensity;
+            color = hvec3_add(color, hvec3_mul(ambient, intensity));
+        }
+
+        if (uniforms->half.punctual_intensity > 0) {
+            hvec3_t light_dir = hvec3_negate(uniforms->half.light_dir);
+            half_t n_dot_l = hvec3_dot(material.normal, light_dir);
+            if (n_dot_l > 0 && !is_in_shadow(varyings, uniforms, n_dot_l)) {
+                hvec3_t view_dir = get_view_dir(varyings, uniforms);
+                hvec3_t specular = get_specular(light_dir, view_dir, material);
+                hvec3_t diffuse = hvec3_mul(material.diffuse, n_dot_l);
+                hvec3_t punctual = hvec3_add(diffuse, specular);
+                half_t intensity = uniforms->half.punctual_intensity;
+                color = hvec3_add(color, hvec3_mul(punctual, intensity));
+            }
+        }
+
+        return vec4_new((float)color.x, (float)color.y, (float)color.z,
+                        (float)material.alpha);
+    }
+}
+
+vec4_t fragAH(void *varyings_, void *uniforms_,
+              int *discard, int backface) {
+    blinn_varyings_t *varyings = (blinn_varyings_t*)varyings_;
+    blinn_uniforms_t *uniforms = (blinn_uniforms_t*)uniforms_;
+
+    if (uniforms->shadow_pass) {
+        return shadow_fragment_shader(varyings, uniforms, discard);
+    } else {
+        return common_fragment_shader(varyings, uniforms, discard, backface);
+    }
+}
@@ -0,0 +1,247 @@
+#include <inttypes.h>
+#include "../maths.h"
+#include "../fixed.h"
+
+// Fixed-point variant of fragA, loaded with the plugin option precision=fixed.
+// The host converts the varyings and the lighting uniforms to Q16.16 (see
+// convert_varyings in graphics.c and blinn_fixed_t), texels are converted from
+// their bits, so the shader runs no float arithmetic at all.
+
+typedef struct {
+    int width, height;
+    vec4_t *buffer;
+} texture_t;
+
+static q16vec4_t texel_to_fixed(const vec4_t *texel) {
+    const uint32_t *bits = (const uint32_t*)texel;
+    q16vec4_t q;
+    q.x = q16_from_float_bits(bits[0]);
+    q.y = q16_from_float_bits(bits[1]);
+    q.z = q16_from_float_bits(bits[2]);
+    q.w = q16_from_float_bits(bits[3]);
+    return q;
+}
+
+// Same texel as texture_repeat_sample of fragA: the fraction of a Q16.16
+// coordinate is its low 16 bits, also for negative coordinates.
+q16vec4_t texture_repeat_sample(texture_t *texture, q16vec2_t texcoord) {
+    uint32_t u = (uint32_t)texcoord.x & 0xFFFF;
+    uint32_t v = (uint32_t)texcoord.y & 0xFFFF;
+    int c = (int)(((uint64_t)(texture->width - 1) * u) >> 16);
+    int r = (int)(((uint64_t)(texture->height - 1) * v) >> 16);
+    int index = r * texture->width + c;
+    return texel_to_fixed(&texture->buffer[index]);
+}
+
+q16vec4_t texture_sample(texture_t *texture, q16vec2_t texcoord) {
+    return texture_repeat_sample(texture, texcoord);
+}
+
+// End texture
+
+static q16vec3_t q16vec3_from_vec4(q16vec4_t v) {
+    return q16vec3_new(v.x, v.y, v.z);
+}
+
+typedef struct {
+    q16vec3_t diffuse;
+    q16vec3_t specular;
+    q16_t alpha;
+    q16_t shininess;
+    q16vec3_t normal;
+    q16vec3_t emission;
+} material_t;
+
+// blinn_varyings_t of the host, every float converted to Q16.16.
+typedef struct {
+    q16vec3_t world_position;
+    q16vec3_t depth_position;
+    q16vec2_t texcoord;
+    q16vec3_t normal;
+} blinn_varyings_t;
+
+typedef struct {
+    q16vec3_t light_dir;
+    q16vec3_t camera_pos;
+    q16vec4_t basecolor;
+    q16_t ambient_intensity;
+    q16_t punctual_intensity;
+    q16_t shininess;
+    q16_t alpha_cutoff;
+} blinn_fixed_t;
+
+typedef struct {
+    vec3_t light_dir;
+    vec3_t camera_pos;
+    mat4_t model_matrix;
+    mat3_t normal_matrix;
+    mat4_t light_vp_matrix;
+    mat4_t camera_vp_matrix;
+    mat4_t *joint_matrices;
+    mat3_t *joint_n_matrices;
+    float ambient_intensity;
+    float punctual_intensity;
+    texture_t *shadow_map;
+    /* surface parameters */
+    vec4_t basecolor;
+    float shininess;
+    texture_t *diffuse_map;
+    texture_t *specular_map;
+    texture_t *emission_map;
+    /* render controls */
+    float alpha_cutoff;
+    int shadow_pass;
+    /* lower precision copies */
+    blinn_fixed_t fixed;
+} blinn_uniforms_t;
+
+static int is_zero_vector(q16vec3_t v) {
+    return v.x == 0 && v.y == 0 && v.z == 0;
+}
+
+static int is_in_shadow(blinn_varyings_t *varyings,
+                        blinn_uniforms_t *uniforms,
+                        q16_t n_dot_l) {
+    if (uniforms->shadow_map) {
+        q16_t u = (varyings->depth_position.x + Q16_ONE) >> 1;
+        q16_t v = (varyings->depth_position.y + Q16_ONE) >> 1;
+        q16_t d = (varyings->depth_position.z + Q16_ONE) >> 1;
+
+        q16_t depth_bias = q16_max(q16_mul(Q16(0.05f), Q16_ONE - n_dot_l), Q16(0.005f));
+        q16_t current_depth = d - depth_bias;
+        q16vec2_t texcoord = { u, v };
+        q16_t closest_depth = texture_sample(uniforms->shadow_map, texcoord).x;
+
+        return current_depth > closest_depth;
+    } else {
+        return 0;
+    }
+}
+
+static q16vec3_t get_view_dir(blinn_varyings_t *varyings,
+                              blinn_uniforms_t *uniforms) {
+    q16vec3_t camera_pos = uniforms->fixed.camera_pos;
+    q16vec3_t world_pos = varyings->world_position;
+    return q16vec3_normalize(q16vec3_sub(camera_pos, world_pos));
+}
+
+static q16vec3_t get_specular(q16vec3_t light_dir, q16vec3_t view_dir,
+                              material_t material) {
+    if (!is_zero_vector(material.specular)) {
+        q16vec3_t half_dir = q16vec3_normalize(q16vec3_add(light_dir, view_dir));
+        q16_t n_dot_h = q16vec3_dot(material.normal, half_dir);
+        if (n_dot_h > 0) {
+            q16_t strength = q16_pow(n_dot_h, material.shininess);
+            return q16vec3_mul(material.specular, strength);
+        }
+    }
+    return q16vec3_new(0, 0, 0);
+}
+
+static material_t get_material(blinn_varyings_t *varyings,
+                               blinn_uniforms_t *uniforms,
+                               int backface) {
+    q16vec2_t texcoord = varyings->texcoord;
+    q16vec3_t diffuse, specular, normal, emission;
+    q16_t alpha, shininess;
+    material_t material;
+
+    diffuse = q16vec3_from_vec4(uniforms->fixed.basecolor);
+    alpha = uniforms->fixed.basecolor.w;
+    if (uniforms->diffuse_map) {
+        q16vec4_t sample = texture_sample(uniforms->diffuse_map, texcoord);
+        diffuse = q16vec3_modulate(diffuse, q16vec3_from_vec4(sample));
+        alpha = q16_mul(alpha, sample.w);
+    }
+
+    specular = q16vec3_new(0, 0, 0);
+    if (uniforms->specular_map) {
+        q16vec4_t sample = texture_sample(uniforms->specular_map, texcoord);
+        specular = q16vec3_from_vec4(sample);
+    }
+    shininess = uniforms->fixed.shininess;
+
+    normal = q16vec3_normalize(varyings->normal);
+    if (backface) {
+        normal = q16vec3_negate(normal);
+    }
+
+    emission = q16vec3_new(0, 0, 0);
+    if (uniforms->emission_map) {
+        q16vec4_t sample = texture_sample(uniforms->emission_map, texcoord);
+        emission = q16vec3_from_vec4(sample);
+    }
+
+    material.diffuse = diffuse;
+    material.specular = specular;
+    material.alpha = alpha;
+    material.shininess = shininess;
+    material.normal = normal;
+    material.emission = emission;
+    return material;
+}
+
+static vec4_t shadow_fragment_shader(blinn_varyings_t *varyings,
+                                     blinn_uniforms_t *uniforms,
+                                     int *discard) {
+    q16_t alpha_cutoff = uniforms->fixed.alpha_cutoff;
+    if (alpha_cutoff > 0) {
+        q16_t alpha = uniforms->fixed.basecolor.w;
+        if (uniforms->diffuse_map) {
+            q16vec2_t texcoord = varyings->texcoord;
+            alpha = q16_mul(alpha, texture_sample(uniforms->diffuse_map, texcoord).w);
+        }
+        if (alpha < alpha_cutoff) {
+            *discard = 1;
+        }
+    }
+    return vec4_new(0, 0, 0, 0);
+}
+
+static vec4_t common_fragment_shader(blinn_varyings_t *varyings,
+                                     blinn_uniforms_t *uniforms,
+                                     int *discard,
+                                     int backface) {
+    material_t material = get_material(varyings, uniforms, backface);
+    q16_t alpha_cutoff = uniforms->fixed.alpha_cutoff;
+    if (alpha_cutoff > 0 && material.alpha < alpha_cutoff) {
+        *discard = 1;
+        return vec4_new(0, 0, 0, 0);
+    } else {
+        q16vec3_t color = material.emission;
+
+        if (uniforms->fixed.ambient_intensity > 0) {
+            q16vec3_t ambient = material.diffuse;
+            q16_t intensity = uniforms->fixed.ambient_intensity;
+            color = q16vec3_add(color, q16vec3_mul(ambient, intensity));
+        }
+
+        if (uniforms->fixed.punctual_intensity > 0) {
+            q16vec3_t light_dir = q16vec3_negate(uniforms->fixed.light_dir);
+            q16_t n_dot_l = q16vec3_dot(material.normal, light_dir);
+            if (n_dot_l > 0 && !is_in_shadow(varyings, uniforms, n_dot_l)) {
+                q16vec3_t view_dir = get_view_dir(varyings, uniforms);
+                q16vec3_t specular = get_specular(light_dir, view_dir, material);
+                q16vec3_t diffuse = q16vec3_mul(material.diffuse, n_dot_l);
+                q16vec3_t punctual = q16vec3_add(diffuse, specular);
+                q16_t intensity = uniforms->fixed.punctual_intensity;
+                color = q16vec3_add(color, q16vec3_mul(punctual, intensity));
+            }
+        }
+
+        return vec4_new(q16_to_float(color.x), q16_to_float(color.y),
+                        q16_to_float(color.z), q16_to_float(material.alpha));
+    }
+}
+
+vec4_t fragAQ(void *varyings_, void *uniforms_,
+              int *discard, int backface) {
+    blinn_varyings_t *varyings = (blinn_varyings_t*)varyings_;
+    blinn_uniforms_t *uniforms = (blinn_uniforms_t*)uniforms_;
+
+    if (uniforms->shadow_pass) {
+        return shadow_fragment_shader(varyings, uniforms, discard);
+    } else {
+        return common_fragment_shader(varyings, uniforms, discard, backface);
+    }
+}
@@ -0,0 +1,173 @@
+#include <stddef.h>
+#include "fragA.c"
+#include "../vmath.h"
+#include "plugin_ring.h"
+
+// Batch variant of fragA: shades count fragments per call. Texture fetches
+// and powf have no vector form, they run per fragment on a chunk of CHUNK
+// fragments and leave their results in the scratch arrays below, the lighting
+// then runs on vl fragments of the chunk at a time. The shadow pass runs
+// fragA on each fragment.
+
+#define CHUNK 64
+#define VARYING(field) (offsetof(fs_job_t, varyings) + offsetof(blinn_varyings_t, field))
+#define RESULT(field) offsetof(fs_result_t, field)
+
+typedef struct {
+    float diffuse[3][CHUNK];
+    float specular[3][CHUNK];
+    float emission[3][CHUNK];
+    float alpha[CHUNK];
+    float closest_depth[CHUNK];
+    float n_dot_h[CHUNK];
+} scratch_t;
+
+static void sample_chunk(const fs_job_t *jobs, uint64_t count, blinn_uniforms_t *uniforms, scratch_t *s) {
+    for (uint64_t i = 0; i < count; ++i) {
+        const blinn_varyings_t *varyings = (const blinn_varyings_t*)jobs[i].varyings;
+        vec2_t texcoord = varyings->texcoord;
+        vec4_t diffuse = uniforms->basecolor;
+        vec4_t specular = vec4_new(0, 0, 0, 0);
+        vec4_t emission = vec4_new(0, 0, 0, 0);
+
+        if (uniforms->diffuse_map)
+            diffuse = vec4_modulate(diffuse, texture_sample(uniforms->diffuse_map, texcoord));
+        if (uniforms->specular_map)
+            specular = texture_sample(uniforms->specular_map, texcoord);
+        if (uniforms->emission_map)
+            emission = texture_sample(uniforms->emission_map, texcoord);
+        if (uniforms->shadow_map) {
+            float u = (varyings->depth_position.x + 1) * 0.5f;
+            float v = (varyings->depth_position.y + 1) * 0.5f;
+            s->closest_depth[i] = texture_sample(uniforms->shadow_map, vec2_new(u, v)).x;
+        }
+
+        s->diffuse[0][i] = diffuse.x;
+        s->diffuse[1][i] = diffuse.y;
+        s->diffuse[2][i] = diffuse.z;
+        s->alpha[i] = diffuse.w;
+        s->specular[0][i] = specular.x;
+        s->specular[1][i] = specular.y;
+        s->specular[2][i] = specular.z;
+        s->emission[0][i] = emission.x;
+        s->emission[1][i] = emission.y;
+        s->emission[2][i] = emission.z;
+    }
+}
+
+static inline vfloat_t vload_scratch(const float *first, size_t vl) {
+    return __riscv_vle32_v_f32m1(first, vl);
+}
+
+static void shade_chunk(const fs_job_t *jobs, fs_result_t *results, uint64_t count,
+                        blinn_uniforms_t *uniforms, scratch_t *s) {
+    const ptrdiff_t jstride = sizeof(fs_job_t);
+    const ptrdiff_t rstride = sizeof(fs_result_t);
+    vec3_t light_dir = vec3_negate(uniforms->light_dir);
+    vec3_t camera_pos = uniforms->camera_pos;
+
+    for (uint64_t k = 0; k < count;) {
+        size_t vl = __riscv_vsetvl_e32m1(count - k);
+        const fs_job_t *job = &jobs[k];
+        fs_result_t *result = &results[k];
+        vfloat_t zero = vsplat(0, vl);
+        vfloat_t alpha = vload_scratch(&s->alpha[k], vl);
+        vfloat_t diffuse[3], color[3];
+        vmask_t discard = __riscv_vmclr_m_b32(vl);
+
+        if (uniforms->alpha_cutoff > 0)
+            discard = __riscv_vmflt_vf_f32m1_b32(alpha, uniforms->alpha_cutoff, vl);
+
+        for (int c = 0; c < 3; ++c) {
+            diffuse[c] = vload_scratch(&s->diffuse[c][k], vl);
+            color[c] = vload_scratch(&s->emission[c][k], vl);
+            if (uniforms->ambient_intensity > 0)
+                color[c] = __riscv_vfmacc_vf_f32m1(color[c], uniforms->ambient_intensity, diffuse[c], vl);
+        }
+
+        if (uniforms->punctual_intensity > 0) {
+            vfloat_t nx = vload(job, VARYING(normal.x), jstride, vl);
+            vfloat_t ny = vload(job, VARYING(normal.y), jstride, vl);
+            vfloat_t nz = vload(job, VARYING(normal.z), jstride, vl);
+            vmask_t backface = vload_flag(job, offsetof(fs_job_t, backface), jstride, vl);
+            vnormalize3(&nx, &ny, &nz, vl);
+            nx = vselect(backface, __riscv_vfneg_v_f32m1(nx, vl), nx, vl);
+            ny = vselect(backface, __riscv_vfneg_v_f32m1(ny, vl), ny, vl);
+            nz = vselect(backface, __riscv_vfneg_v_f32m1(nz, vl), nz, vl);
+
+            vfloat_t n_dot_l = __riscv_vfmul_vf_f32m1(nx, light_dir.x, vl);
+            n_dot_l = __riscv_vfmacc_vf_f32m1(n_dot_l, light_dir.y, ny, vl);
+            n_dot_l = __riscv_vfmacc_vf_f32m1(n_dot_l, light_dir.z, nz, vl);
+            vmask_t lit = __riscv_vmfgt_vf_f32m1_b32(n_dot_l, 0, vl);
+
+            if (uniforms->shadow_map) {
+                // current_depth = d - max(0.05 * (1 - n_dot_l), 0.005), with d = (z + 1) / 2
+                vfloat_t z = vload(job, VARYING(depth_position.z), jstride, vl);
+                vfloat_t d = __riscv_vfmul_vf_f32m1(__riscv_vfadd_vf_f32m1(z, 1, vl), 0.5f, vl);
+                vfloat_t bias = __riscv_vfrsub_vf_f32m1(n_dot_l, 1, vl);
+                bias = __riscv_vfmax_vf_f32m1(__riscv_vfmul_vf_f32m1(bias, 0.05f, vl), 0.005f, vl);
+                vfloat_t current_depth = __riscv_vfsub_vv_f32m1(d, bias, vl);
+                vfloat_t closest_depth = vload_scratch(&s->closest_depth[k], vl);
+                vmask_t shadowed = __riscv_vmfgt_vv_f32m1_b32(current_depth, closest_depth, vl);
+                lit = __riscv_vmandn_mm_b32(lit, shadowed, vl);
+            }
+
+            vfloat_t vx = __riscv_vfrsub_vf_f32m1(vload(job, VARYING(world_position.x), jstride, vl),
+                                                  camera_pos.x, vl);
+            vfloat_t vy = __riscv_vfrsub_vf_f32m1(vload(job, VARYING(world_position.y), jstride, vl),
+                                                  camera_pos.y, vl);
+            vfloat_t vz = __riscv_vfrsub_vf_f32m1(vload(job, VARYING(world_position.z), jstride, vl),
+                                                  camera_pos.z, vl);
+            vnormalize3(&vx, &vy, &vz, vl);
+            vfloat_t hx = __riscv_vfadd_vf_f32m1(vx, light_dir.x, vl);
+            vfloat_t hy = __riscv_vfadd_vf_f32m1(vy, light_dir.y, vl);
+            vfloat_t hz = __riscv_vfadd_vf_f32m1(vz, light_dir.z, vl);
+            vnormalize3(&hx, &hy, &hz, vl);
+            __riscv_vse32_v_f32m1(&s->n_dot_h[k], vdot3(nx, ny, nz, hx, hy, hz, vl), vl);
+
+            // A zero specular sample makes the product zero, like the early out of get_specular.
+            for (size_t i = k; i < k + vl; ++i)
+                s->n_dot_h[i] = s->n_dot_h[i] > 0 ? powf(s->n_dot_h[i], uniforms->shininess) : 0;
+            vfloat_t strength = vload_scratch(&s->n_dot_h[k], vl);
+
+            for (int c = 0; c < 3; ++c) {
+                vfloat_t punctual = __riscv_vfmul_vv_f32m1(diffuse[c], n_dot_l, vl);
+                vfloat_t specular = vload_scratch(&s->specular[c][k], vl);
+                punctual = __riscv_vfmacc_vv_f32m1(punctual, specular, strength, vl);
+                vfloat_t lit_color = __riscv_vfmacc_vf_f32m1(color[c], uniforms->punctual_intensity,
+                                                             punctual, vl);
+                color[c] = vselect(lit, lit_color, color[c], vl);
+            }
+        }
+
+        vstore_flag(result, RESULT(discard), rstride, discard, vl);
+        for (int c = 0; c < 3; ++c)
+            vstore(result, RESULT(color) + c * sizeof(float), rstride, vselect(discard, zero, color[c], vl), vl);
+        vstore(result, RESULT(color) + 3 * sizeof(float), rstride, vselect(discard, zero, alpha, vl), vl);
+        k += vl;
+    }
+}
+
+void fragAV(const fs_job_t *jobs, fs_result_t *results, uint64_t count, void *uniforms_) {
+    blinn_uniforms_t *uniforms = (blinn_uniforms_t*)uniforms_;
+    scratch_t scratch;
+
+    if (uniforms->shadow_pass) {
+        for (uint64_t i = 0; i < count; ++i) {
+            int discard = 0;
+            vec4_t color = fragA((void*) jobs[i].varyings, uniforms, &discard, jobs[i].backface);
+            results[i].discard = discard;
+            results[i].color[0] = color.x;
+            results[i].color[1] = color.y;
+            results[i].color[2] = color.z;
+            results[i].color[3] = color.w;
+        }
+        return;
+    }
+
+    for (uint64_t i = 0; i < count; i += CHUNK) {
+        uint64_t n = count - i < CHUNK ? count - i : CHUNK;
+        sample_chunk(&jobs[i], n, uniforms, &scratch);
+        shade_chunk(&jobs[i], &results[i], n, uniforms, &scratch);
+    }
+}
@@ -0,0 +1,577 @@
+#include <math.h>
+#include <inttypes.h>
+#include <string.h>
+#include "../maths.h"
+#include "../tex.h"
+#include "../macro.h"
+
+typedef struct {
+    int width, height;
+    vec4_t *buffer;
+} texture_t;
+
+typedef struct {
+    texture_t *faces[6];
+} cubemap_t;
+
+vec4_t texture_repeat_sample(texture_t *texture, vec2_t texcoord) {
+#ifndef NO_TEX
+    return *tex_repeat(texture, texcoord);
+#else
+    float u = texcoord.x - floorf(texcoord.x);
+    float v = texcoord.y - floorf(texcoord.y);
+    int c = (int)((texture->width - 1) * u);
+    int r = (int)((texture->height - 1) * v);
+    int index = r * texture->width + c;
+    return texture->buffer[index];
+#endif
+}
+
+vec4_t texture_clamp_sample(texture_t *texture, vec2_t texcoord) {
+#ifndef NO_TEX
+    return *tex_clamp(texture, texcoord);
+#else
+    float u = float_saturate(texcoord.x);
+    float v = float_saturate(texcoord.y);
+    int c = (int)((texture->width - 1) * u);
+    int r = (int)((texture->height - 1) * v);
+    int index = r * texture->width + c;
+    return texture->buffer[index];
+#endif
+}
+
+vec4_t texture_sample(texture_t *texture, vec2_t texcoord) {
+    return texture_repeat_sample(texture, texcoord);
+}
+
+/*
+ * for cubemap sampling, see subsection 3.7.5 of
+ * https://www.khronos.org/registry/OpenGL/specs/es/2.0/es_full_spec_2.0.pdf
+ */
+static int select_cubemap_face(vec3_t direction, vec2_t *texcoord) {
+    float abs_x = fabsf(direction.x);
+    float abs_y = fabsf(direction.y);
+    float abs_z = fabsf(direction.z);
+    float ma, sc, tc;
+    int face_index;
+
+    if (abs_x > abs_y && abs_x > abs_z) {   /* major axis -> x */
+        ma = abs_x;
+        if (direction.x > 0) {                  /* positive x */
+            face_index = 0;
+            sc = -direction.z;
+            tc = -direction.y;
+        } else {                                /* negative x */
+            face_index = 1;
+            sc = +direction.z;
+            tc = -direction.y;
+        }
+    } else if (abs_y > abs_z) {             /* major axis -> y */
+        ma = abs_y;
+        if (direction.y > 0) {                  /* positive y */
+            face_index = 2;
+            sc = +direction.x;
+            tc = +direction.z;
+        } else {                                /* negative y */
+            face_index = 3;
+            sc = +direction.x;
+            tc = -direction.z;
+        }
+    } else {                                /* major axis -> z */
+        ma = abs_z;
+        if (direction.z > 0) {                  /* positive z */
+            face_index = 4;
+            sc = +direction.x;
+            tc = -direction.y;
+        } else {                                /* negative z */
+            face_index = 5;
+            sc = -direction.x;
+            tc = -direction.y;
+        }
+    }
+
+    texcoord->x = (sc / ma + 1) / 2;
+    texcoord->y = (tc / ma + 1) / 2;
+    return face_index;
+}
+
+vec4_t cubemap_repeat_sample(cubemap_t *cubemap, vec3_t direction) {
+    vec2_t texcoord;
+    int face_index = select_cubemap_face(direction, &texcoord);
+    texcoord.y = 1 - texcoord.y;
+    return texture_repeat_sample(cubemap->faces[face_index], texcoord);
+}
+
+vec4_t cubemap_clamp_sample(cubemap_t *cubemap, vec3_t direction) {
+    vec2_t texcoord;
+    int face_index = select_cubemap_face(direction, &texcoord);
+    texcoord.y = 1 - texcoord.y;
+    return texture_clamp_sample(cubemap->faces[face_index], texcoord);
+}
+
+vec4_t cubemap_sample(cubemap_t *cubemap, vec3_t direction) {
+    return cubemap_repeat_sample(cubemap, direction);
+}
+
+// End texture
+
+typedef enum {
+    METALNESS_WORKFLOW,
+    SPECULAR_WORKFLOW
+} workflow_t;
+
+typedef struct {
+    int mip_levels;
+    cubemap_t *diffuse_map;
+    cubemap_t *specular_maps[15];
+    texture_t *brdf_lut;
+} ibldata_t;
+
+typedef struct {
+    vec3_t position;
+    vec2_t texcoord;
+    vec3_t normal;
+    vec4_t tangent;
+    vec4_t joint;
+    vec4_t weight;
+} pbr_attribs_t;
+
+typedef struct {
+    vec3_t world_position;
+    vec3_t depth_position;
+    vec4_t clip_position;
+    vec3_t world_normal;
+    vec3_t world_tangent;
+    vec3_t world_bitangent;
+    vec2_t texcoord;
+} pbr_varyings_t;
+
+typedef struct {
+    vec3_t light_dir;
+    vec3_t camera_pos;
+    mat4_t model_matrix;
+    mat3_t normal_matrix;
+    mat4_t light_vp_matrix;
+    mat4_t camera_vp_matrix;
+    mat4_t *joint_matrices;
+    mat3_t *joint_n_matrices;
+    float ambient_intensity;
+    float punctual_intensity;
+    texture_t *shadow_map;
+    /* metalness workflow */
+    vec4_t basecolor_factor;
+    float metalness_factor;
+    float roughness_factor;
+    texture_t *basecolor_map;
+    texture_t *metalness_map;
+    texture_t *roughness_map;
+    /* specular workflow */
+    vec4_t diffuse_factor;
+    vec3_t specular_factor;
+    float glossiness_factor;
+    texture_t *diffuse_map;
+    texture_t *specular_map;
+    texture_t *glossiness_map;
+    /* additional maps */
+    texture_t *normal_map;
+    texture_t *occlusion_map;
+    texture_t *emission_map;
+    /* environment maps */
+    ibldata_t *ibldata;
+    /* render controls */
+    workflow_t workflow;
+    float alpha_cutoff;
+    int shadow_pass;
+    int layer_view;
+} pbr_uniforms_t;
+
+static vec4_t shadow_fragment_shader(pbr_varyings_t *varyings,
+                                     pbr_uniforms_t *uniforms,
+                                     int *discard) {
+    if (uniforms->alpha_cutoff > 0) {
+        float alpha;
+        if (uniforms->workflow == METALNESS_WORKFLOW) {
+            alpha = uniforms->basecolor_factor.w;
+            if (uniforms->basecolor_map) {
+                vec2_t texcoord = varyings->texcoord;
+                alpha *= texture_sample(uniforms->basecolor_map, texcoord).w;
+            }
+        } else {
+            alpha = uniforms->diffuse_factor.w;
+            if (uniforms->diffuse_map) {
+                vec2_t texcoord = varyings->texcoord;
+                alpha *= texture_sample(uniforms->diffuse_map, texcoord).w;
+            }
+        }
+        if (alpha < uniforms->alpha_cutoff) {
+            *discard = 1;
+        }
+    }
+    return vec4_new(0, 0, 0, 0);
+}
+
+typedef struct {
+    vec3_t diffuse;
+    vec3_t specular;
+    float alpha;
+    float roughness;
+    vec3_t normal;
+    float occlusion;
+    vec3_t emission;
+} material_t;
+
+static material_t get_pbrm_material(pbr_uniforms_t *uniforms, vec2_t texcoord) {
+    vec3_t diffuse, specular, basecolor;
+    float alpha, roughness, metalness;
+    material_t material;
+
+    basecolor = vec3_from_vec4(uniforms->basecolor_factor);
+    alpha = uniforms->basecolor_factor.w;
+    if (uniforms->basecolor_map) {
+        vec4_t sample = texture_sample(uniforms->basecolor_map, texcoord);
+        basecolor = vec3_modulate(basecolor, vec3_from_vec4(sample));
+        alpha *= sample.w;
+    }
+
+    metalness = uniforms->metalness_factor;
+    if (uniforms->metalness_map) {
+        vec4_t sample = texture_sample(uniforms->metalness_map, texcoord);
+        metalness *= sample.x;
+    }
+
+    roughness = uniforms->roughness_factor;
+    if (uniforms->roughness_map) {
+        vec4_t sample = texture_sample(uniforms->roughness_map, texcoord);
+        roughness *= sample.x;
+    }
+
+    diffuse = vec3_mul(basecolor, (1 - 0.04f) * (1 - metalness));
+    specular = vec3_lerp(vec3_new(0.04f, 0.04f, 0.04f), basecolor, metalness);
+
+    memset(&material, 0, sizeof(material_t));
+    material.diffuse = diffuse;
+    material.specular = specular;
+    material.alpha = alpha;
+    material.roughness = roughness;
+    return material;
+}
+
+static float max_component(vec3_t v) {
+    return v.x > v.y && v.x > v.z ? v.x : (v.y > v.z ? v.y : v.z);
+}
+
+static material_t get_pbrs_material(pbr_uniforms_t *uniforms, vec2_t texcoord) {
+    vec3_t diffuse, specular;
+    float alpha, roughness, glossiness;
+    material_t material;
+
+    diffuse = vec3_from_vec4(uniforms->diffuse_factor);
+    alpha = uniforms->diffuse_factor.w;
+    if (uniforms->diffuse_map) {
+        vec4_t sample = texture_sample(uniforms->diffuse_map, texcoord);
+        diffuse = vec3_modulate(diffuse, vec3_from_vec4(sample));
+        alpha *= sample.w;
+    }
+
+    specular = uniforms->specular_factor;
+    if (uniforms->specular_map) {
+        vec4_t sample = texture_sample(uniforms->specular_map, texcoord);
+        specular = vec3_modulate(specular, vec3_from_vec4(sample));
+    }
+
+    glossiness = uniforms->glossiness_factor;
+    if (uniforms->glossiness_map) {
+        vec4_t sample = texture_sample(uniforms->glossiness_map, texcoord);
+        glossiness *= sample.x;
+    }
+
+    diffuse = vec3_mul(diffuse, 1 - max_component(specular));
+    roughness = 1 - glossiness;
+
+    memset(&material, 0, sizeof(material_t));
+    material.diffuse = diffuse;
+    material.specular = specular;
+    material.alpha = alpha;
+    material.roughness = roughness;
+    return material;
+}
+
+static vec3_t get_normal_dir(pbr_varyings_t *varyings,
+                             pbr_uniforms_t *uniforms,
+                             int backface) {
+    vec3_t normal_dir;
+    if (uniforms->normal_map) {
+        vec4_t sample = texture_sample(uniforms->normal_map,
+                                       varyings->texcoord);
+        vec3_t tangent_normal = vec3_new(sample.x * 2 - 1,
+                                         sample.y * 2 - 1,
+                                         sample.z * 2 - 1);
+        mat3_t tbn_matrix = mat3_from_cols(varyings->world_tangent,
+                                           varyings->world_bitangent,
+                                           varyings->world_normal);
+        vec3_t world_normal = mat3_mul_vec3(tbn_matrix, tangent_normal);
+        normal_dir = vec3_normalize(world_normal);
+    } else {
+        normal_dir = vec3_normalize(varyings->world_normal);
+    }
+    return backface ? vec3_negate(normal_dir) : normal_dir;
+}
+
+static material_t get_pixel_material(pbr_varyings_t *varyings,
+                                     pbr_uniforms_t *uniforms,
+                                     int backface) {
+    vec2_t texcoord = varyings->texcoord;
+    material_t material;
+
+    if (uniforms->workflow == METALNESS_WORKFLOW) {
+        material = get_pbrm_material(uniforms, texcoord);
+    } else {
+        material = get_pbrs_material(uniforms, texcoord);
+    }
+
+    material.normal = get_normal_dir(varyings, uniforms, backface);
+
+    if (uniforms->occlusion_map) {
+        vec4_t sample = texture_sample(uniforms->occlusion_map, texcoord);
+        material.occlusion = sample.x;
+    } else {
+        material.occlusion = 1;
+    }
+
+    if (uniforms->emission_map) {
+        vec4_t sample = texture_sample(uniforms->emission_map, texcoord);
+        material.emission = vec3_from_vec4(sample);
+    } else {
+        material.emission = vec3_new(0, 0, 0);
+    }
+
+    return material;
+}
+
+static vec3_t get_incident_dir(vec3_t normal_dir, vec3_t view_dir) {
+    float n_dot_v = vec3_dot(normal_dir, view_dir);
+    return vec3_sub(vec3_mul(normal_dir, 2 * n_dot_v), view_dir);
+}
+
+static vec3_t get_ibl_shade(material_t material, ibldata_t *ibldata,
+                            vec3_t normal_dir, vec3_t view_dir) {
+    vec3_t diffuse_color = vec3_mul(material.diffuse, material.occlusion);
+    cubemap_t *diffuse_map = ibldata->diffuse_map;
+    vec4_t diffuse_sample = cubemap_clamp_sample(diffuse_map, normal_dir);
+    vec3_t diffuse_light = vec3_from_vec4(diffuse_sample);
+    vec3_t diffuse_shade = vec3_modulate(diffuse_light, diffuse_color);
+
+    float n_dot_v = vec3_dot(normal_dir, view_dir);
+    vec2_t lut_texcoord = vec2_new(n_dot_v, material.roughness);
+    vec4_t lut_sample = texture_clamp_sample(ibldata->brdf_lut, lut_texcoord);
+    float specular_scale = lut_sample.x;
+    float specular_bias = lut_sample.y;
+
+    float specular_r = material.specular.x * specular_scale + specular_bias;
+    float specular_g = material.specular.y * specular_scale + specular_bias;
+    float specular_b = material.specular.z * specular_scale + specular_bias;
+    vec3_t specular_color = vec3_new(specular_r, specular_g, specular_b);
+
+    vec3_t incident_dir = get_incident_dir(normal_dir, view_dir);
+    float max_mip_level = (float)(ibldata->mip_levels - 1);
+    int specular_lod = (int)(material.roughness * max_mip_level + 0.5f);
+    cubemap_t *specular_map = ibldata->specular_maps[specular_lod];
+    vec4_t specular_sample = cubemap_clamp_sample(specular_map, incident_dir);
+    vec3_t specular_light = vec3_from_vec4(specular_sample);
+    vec3_t specular_shade = vec3_modulate(specular_light, specular_color);
+
+    return vec3_add(diffuse_shade, specular_shade);
+}
+
+static int is_in_shadow(pbr_varyings_t *varyings,
+                        pbr_uniforms_t *uniforms,
+                        float n_dot_l) {
+    if (uniforms->shadow_map) {
+        float u = (varyings->depth_position.x + 1) * 0.5f;
+        float v = (varyings->depth_position.y + 1) * 0.5f;
+        float d = (varyings->depth_position.z + 1) * 0.5f;
+
+        float depth_bias = float_max(0.05f * (1 - n_dot_l), 0.005f);
+        float current_depth = d - depth_bias;
+        vec2_t texcoord = vec2_new(u, v);
+        float closest_depth = texture_sample(uniforms->shadow_map, texcoord).x;
+
+        return current_depth > closest_depth;
+    } else {
+        return 0;
+    }
+}
+
+/*
+ * for normal distribution function, see
+ * Microfacet Models for Refraction through Rough Surfaces
+ */
+static float get_distribution(float n_dot_h, float alpha2) {
+    float n_dot_h_2 = n_dot_h * n_dot_h;
+    float factor = n_dot_h_2 * (alpha2 - 1) + 1;
+    return alpha2 / (PI * factor * factor);
+}
+
+/*
+ * for visibility function, see
+ * Understanding the Masking-Shadowing Function in Microfacet-Based BRDFs
+ */
+static float get_visibility(float n_dot_v, float n_dot_l, float alpha2) {
+    float n_dot_v_2 = n_dot_v * n_dot_v;
+    float n_dot_l_2 = n_dot_l * n_dot_l;
+    float ggx_v = n_dot_l * sqrtf(n_dot_v_2 * (1 - alpha2) + alpha2);
+    float ggx_l = n_dot_v * sqrtf(n_dot_l_2 * (1 - alpha2) + alpha2);
+    return 0.5f / (ggx_v + ggx_l);
+}
+
+/*
+ * for fresnel approximation, see
+ * An Inexpensive BRDF Model for Physically-based Rendering
+ */
+static vec3_t get_fresnel(float v_dot_h, vec3_t fresnel0) {
+    float factor = powf(1 - v_dot_h, 5);
+    float fresnel90 = float_saturate(max_component(fresnel0) * 50);
+    float fresnel_r = fresnel0.x + (fresnel90 - fresnel0.x) * factor;
+    float fresnel_g = fresnel0.y + (fresnel90 - fresnel0.y) * factor;
+    float fresnel_b = fresnel0.z + (fresnel90 - fresnel0.z) * factor;
+    return vec3_new(fresnel_r, fresnel_g, fresnel_b);
+}
+
+static vec3_t get_dir_shade(material_t material, vec3_t light_dir,
+                            vec3_t normal_dir, vec3_t view_dir) {
+    float n_dot_l = vec3_dot(normal_dir, light_dir);
+    float n_dot_v = vec3_dot(normal_dir, view_dir);
+    if (n_dot_l > 0 && n_dot_v > 0) {
+        vec3_t half_dir = vec3_normalize(vec3_add(light_dir, view_dir));
+        float n_dot_h = float_max(vec3_dot(normal_dir, half_dir), 0);
+        float v_dot_h = float_max(vec3_dot(view_dir, half_dir), 0);
+
+        float alpha_roughness = material.roughness * material.roughness;
+        float alpha2 = alpha_roughness * alpha_roughness;
+
+        float d_term = get_distribution(n_dot_h, alpha2);
+        float v_term = get_visibility(n_dot_v, n_dot_l, alpha2);
+        vec3_t f_term = get_fresnel(v_dot_h, material.specular);
+
+        vec3_t diffuse_lobe = vec3_div(material.diffuse, PI);
+        vec3_t specular_lobe = vec3_mul(f_term, v_term * d_term);
+
+        float combined_r = (1 - f_term.x) * diffuse_lobe.x + specular_lobe.x;
+        float combined_g = (1 - f_term.y) * diffuse_lobe.y + specular_lobe.y;
+        float combined_b = (1 - f_term.z) * diffuse_lobe.z + specular_lobe.z;
+        vec3_t combined_lobe = vec3_new(combined_r, combined_g, combined_b);
+
+        return vec3_mul(combined_lobe, n_dot_l);
+    } else {
+        return vec3_new(0, 0, 0);
+    }
+}
+
+static vec3_t get_view_dir(pbr_varyings_t *varyings, pbr_uniforms_t *uniforms) {
+    vec3_t camera_pos = uniforms->camera_pos;
+    vec3_t world_pos = varyings->world_position;
+    return vec3_normalize(vec3_sub(camera_pos, world_pos));
+}
+
+static vec4_t linear_to_srgb(vec3_t color, float alpha) {
+    float r = float_linear2srgb(float_aces(color.x));
+    float g = float_linear2srgb(float_aces(color.y));
+    float b = float_linear2srgb(float_aces(color.z));
+    return vec4_new(r, g, b, alpha);
+}
+
+#define NUM_EDGES 5
+#define EDGE_SPACE 0.15f
+#define EDGE_START (1 - EDGE_SPACE * 0.5f)
+#define EDGE_END (EDGE_SPACE * (NUM_EDGES - 0.5f))
+
+static int above_layer_edge(int edge, vec2_t coord) {
+    float offset = EDGE_SPACE * (float)edge;
+    vec2_t start = vec2_new(EDGE_START - offset, 0);
+    vec2_t end = vec2_new(EDGE_END - offset, 1);
+    return vec2_edge(start, end, coord) > 0;
+}
+
+static vec4_t get_layer_color(int layer, material_t material) {
+    float alpha = material.alpha;
+    if (layer == 1) {
+        return linear_to_srgb(material.diffuse, alpha);
+    } else if (layer == 2) {
+        return linear_to_srgb(material.specular, alpha);
+    } else if (layer == 3) {
+        float roughness = material.roughness;
+        return vec4_new(roughness, roughness, roughness, alpha);
+    } else if (layer == 4) {
+        float occlusion = material.occlusion;
+        return vec4_new(occlusion, occlusion, occlusion, alpha);
+    } else {
+        float normal_x = material.normal.x * 0.5f + 0.5f;
+        float normal_y = material.normal.y * 0.5f + 0.5f;
+        float normal_z = material.normal.z * 0.5f + 0.5f;
+        return vec4_new(normal_x, normal_y, normal_z, alpha);
+    }
+}
+
+static vec2_t get_normalized_coord(vec4_t clip_coord) {
+    float x = clip_coord.x / clip_coord.w * 0.5f + 0.5f;
+    float y = clip_coord.y / clip_coord.w * 0.5f + 0.5f;
+    return vec2_new(x, y);
+}
+
+static vec4_t common_fragment_shader(pbr_varyings_t *varyings,
+                                     pbr_uniforms_t *uniforms,
+                                     int *discard,
+                                     int backface) {
+    material_t material = get_pixel_material(varyings, uniforms, backface);
+    vec2_t coord = get_normalized_coord(varyings->clip_position);
+    if (uniforms->alpha_cutoff > 0 && material.alpha < uniforms->alpha_cutoff) {
+        *discard = 1;
+        return vec4_new(0, 0, 0, 0);
+    } else if (uniforms->layer_view > 0) {
+        return get_layer_color(uniforms->layer_view, material);
+    } else if (uniforms->layer_view == 0 && !above_layer_edge(0, coord)) {
+        int edge;
+        for (edge = 1; edge < NUM_EDGES; edge++) {
+            if (above_layer_edge(edge, coord)) {
+                break;
+            }
+        }
+        return get_layer_color(edge, material);
+    } else {
+        vec3_t view_dir = get_view_dir(varyings, uniforms);
+        vec3_t light_dir = vec3_negate(uniforms->light_dir);
+        vec3_t normal_dir = material.normal;
+        float n_dot_l = vec3_dot(normal_dir, light_dir);
+        vec3_t color = material.emission;
+
+        if (uniforms->ambient_intensity > 0 && uniforms->ibldata) {
+            float intensity = uniforms->ambient_intensity;
+            vec3_t shade = get_ibl_shade(material, uniforms->ibldata,
+                                         normal_dir, view_dir);
+            color = vec3_add(color, vec3_mul(shade, intensity));
+        }
+
+        if (uniforms->punctual_intensity > 0 && n_dot_l > 0) {
+            float intensity = uniforms->punctual_intensity;
+            if (!is_in_shadow(varyings, uniforms, n_dot_l)) {
+                vec3_t shade = get_dir_shade(material, light_dir,
+                                             normal_dir, view_dir);
+                color = vec3_add(color, vec3_mul(shade, intensity));
+            }
+        }
+
+        return linear_to_srgb(color, material.alpha);
+    }
+}
+
+vec4_t fragPbr(void *varyings_, void *uniforms_,
+                           int *discard, int backface) {
+    pbr_varyings_t *varyings = (pbr_varyings_t*)varyings_;
+    pbr_uniforms_t *uniforms = (pbr_uniforms_t*)uniforms_;
+
+    if (uniforms->shadow_pass) {
+        return shadow_fragment_shader(varyings, uniforms, discard);
+    } else {
+        return common_fragment_shader(varyings, uniforms, discard, backface);
+    }
+}
@@ -0,0 +1,138 @@
+#include <math.h>
+#include <inttypes.h>
+#include "../maths.h"
+#include "../tex.h"
+#include "../macro.h"
+
+typedef struct {
+    int width, height;
+    vec4_t *buffer;
+} texture_t;
+
+typedef struct {
+    texture_t *faces[6];
+} cubemap_t;
+
+vec4_t texture_repeat_sample(texture_t *texture, vec2_t texcoord) {
+#ifndef NO_TEX
+    return *tex_repeat(texture, texcoord);
+#else
+    float u = texcoord.x - floorf(texcoord.x);
+    float v = texcoord.y - floorf(texcoord.y);
+    int c = (int)((texture->width - 1) * u);
+    int r = (int)((texture->height - 1) * v);
+    int index = r * texture->width + c;
+    return texture->buffer[index];
+#endif
+}
+
+vec4_t texture_clamp_sample(texture_t *texture, vec2_t texcoord) {
+#ifndef NO_TEX
+    return *tex_clamp(texture, texcoord);
+#else
+    float u = float_saturate(texcoord.x);
+    float v = float_saturate(texcoord.y);
+    int c = (int)((texture->width - 1) * u);
+    int r = (int)((texture->height - 1) * v);
+    int index = r * texture->width + c;
+    return texture->buffer[index];
+#endif
+}
+
+vec4_t texture_sample(texture_t *texture, vec2_t texcoord) {
+    return texture_repeat_sample(texture, texcoord);
+}
+
+/*
+ * for cubemap sampling, see subsection 3.7.5 of
+ * https://www.khronos.org/registry/OpenGL/specs/es/2.0/es_full_spec_2.0.pdf
+ */
+static int select_cubemap_face(vec3_t direction, vec2_t *texcoord) {
+    float abs_x = fabsf(direction.x);
+    float abs_y = fabsf(direction.y);
+    float abs_z = fabsf(direction.z);
+    float ma, sc, tc;
+    int face_index;
+
+    if (abs_x > abs_y && abs_x > abs_z) {   /* major axis -> x */
+        ma = abs_x;
+        if (direction.x > 0) {                  /* positive x */
+            face_index = 0;
+            sc = -direction.z;
+            tc = -direction.y;
+        } else {                                /* negative x */
+            face_index = 1;
+            sc = +direction.z;
+            tc = -direction.y;
+        }
+    } else if (abs_y > abs_z) {             /* major axis -> y */
+        ma = abs_y;
+        if (direction.y > 0) {                  /* positive y */
+            face_index = 2;
+            sc = +direction.x;
+            tc = +direction.z;
+        } else {                                /* negative y */
+            face_index = 3;
+            sc = +direction.x;
+            tc = -direction.z;
+        }
+    } else {                                /* major axis -> z */
+        ma = abs_z;
+        if (direction.z > 0) {                  /* positive z */
+            face_index = 4;
+            sc = +direction.x;
+            tc = -direction.y;
+        } else {                                /* negative z */
+            face_index = 5;
+            sc = -direction.x;
+            tc = -direction.y;
+        }
+    }
+
+    texcoord->x = (sc / ma + 1) / 2;
+    texcoord->y = (tc / ma + 1) / 2;
+    return face_index;
+}
+
+vec4_t cubemap_repeat_sample(cubemap_t *cubemap, vec3_t direction) {
+    vec2_t texcoord;
+    int face_index = select_cubemap_face(direction, &texcoord);
+    texcoord.y = 1 - texcoord.y;
+    return texture_repeat_sample(cubemap->faces[face_index], texcoord);
+}
+
+vec4_t cubemap_clamp_sample(cubemap_t *cubemap, vec3_t direction) {
+    vec2_t texcoord;
+    int face_index = select_cubemap_face(direction, &texcoord);
+    texcoord.y = 1 - texcoord.y;
+    return texture_clamp_sample(cubemap->faces[face_index], texcoord);
+}
+
+vec4_t cubemap_sample(cubemap_t *cubemap, vec3_t direction) {
+    return cubemap_repeat_sample(cubemap, direction);
+}
+
+// End texture
+
+typedef struct {
+    vec3_t position;
+} skybox_attribs_t;
+
+typedef struct {
+    vec3_t direction;
+} skybox_varyings_t;
+
+typedef struct {
+    mat4_t vp_matrix;
+    cubemap_t *skybox;
+} skybox_uniforms_t;
+
+vec4_t fragSkybox(void *varyings_, void *uniforms_,
+                  int *discard, int backface) {
+    skybox_varyings_t *varyings = (skybox_varyings_t*)varyings_;
+    skybox_uniforms_t *uniforms = (skybox_uniforms_t*)uniforms_;
+
+    UNUSED_VAR(discard);
+    UNUSED_VAR(backface);
+    return cubemap_sample(uniforms->skybox, varyings->direction);
+}
@@ -0,0 +1,76 @@
+#include <stddef.h>
+#include "vertA.c"
+#include "../vmath.h"
+#include "plugin_ring.h"
+
+// Batch variant of vertA: transforms count vertices per call, vl of them per
+// vector operation. Skinned meshes take a different matrix per vertex and run
+// vertA on each vertex instead.
+
+#define ATTRIB(field) offsetof(blinn_attribs_t, field)
+#define VARYING(field) (offsetof(vs_output_t, varyings) + offsetof(blinn_varyings_t, field))
+
+void vertAV(const void *attribs, uint64_t stride, uint64_t count, vs_output_t *outputs, void *uniforms_) {
+    blinn_uniforms_t *uniforms = (blinn_uniforms_t*)uniforms_;
+    const ptrdiff_t ostride = sizeof(vs_output_t);
+    mat4_t model = uniforms->model_matrix;
+    mat4_t light_vp = uniforms->light_vp_matrix;
+    mat4_t camera_vp = uniforms->camera_vp_matrix;
+    mat3_t normal_matrix = uniforms->normal_matrix;
+
+    if (uniforms->joint_matrices || uniforms->joint_n_matrices) {
+        for (uint64_t i = 0; i < count; ++i) {
+            vec4_t coord = vertA((unsigned char*) attribs + i * stride, outputs[i].varyings, uniforms);
+            outputs[i].coord[0] = coord.x;
+            outputs[i].coord[1] = coord.y;
+            outputs[i].coord[2] = coord.z;
+            outputs[i].coord[3] = coord.w;
+        }
+        return;
+    }
+
+    for (uint64_t i = 0; i < count;) {
+        size_t vl = __riscv_vsetvl_e32m1(count - i);
+        const unsigned char *in = (const unsigned char*) attribs + i * stride;
+        vs_output_t *out = &outputs[i];
+
+        vfloat_t px = vload(in, ATTRIB(position.x), stride, vl);
+        vfloat_t py = vload(in, ATTRIB(position.y), stride, vl);
+        vfloat_t pz = vload(in, ATTRIB(position.z), stride, vl);
+        vfloat_t wx = vrow4_point(model.m[0], px, py, pz, vl);
+        vfloat_t wy = vrow4_point(model.m[1], px, py, pz, vl);
+        vfloat_t wz = vrow4_point(model.m[2], px, py, pz, vl);
+        vfloat_t ww = vrow4_point(model.m[3], px, py, pz, vl);
+
+        vstore(out, VARYING(texcoord.x), ostride, vload(in, ATTRIB(texcoord.x), stride, vl), vl);
+        vstore(out, VARYING(texcoord.y), ostride, vload(in, ATTRIB(texcoord.y), stride, vl), vl);
+
+        if (uniforms->shadow_pass) {
+            for (int r = 0; r < 4; ++r)
+                vstore(out, offsetof(vs_output_t, coord) + r * sizeof(float), ostride,
+                       vrow4(light_vp.m[r], wx, wy, wz, ww, vl), vl);
+        } else {
+            for (int r = 0; r < 4; ++r)
+                vstore(out, offsetof(vs_output_t, coord) + r * sizeof(float), ostride,
+                       vrow4(camera_vp.m[r], wx, wy, wz, ww, vl), vl);
+            for (int r = 0; r < 3; ++r)
+                vstore(out, VARYING(depth_position) + r * sizeof(float), ostride,
+                       vrow4(light_vp.m[r], wx, wy, wz, ww, vl), vl);
+            vstore(out, VARYING(world_position.x), ostride, wx, vl);
+            vstore(out, VARYING(world_position.y), ostride, wy, vl);
+            vstore(out, VARYING(world_position.z), ostride, wz, vl);
+
+            vfloat_t nx = vload(in, ATTRIB(normal.x), stride, vl);
+            vfloat_t ny = vload(in, ATTRIB(normal.y), stride, vl);
+            vfloat_t nz = vload(in, ATTRIB(normal.z), stride, vl);
+            vfloat_t tx = vrow3(normal_matrix.m[0], nx, ny, nz, vl);
+            vfloat_t ty = vrow3(normal_matrix.m[1], nx, ny, nz, vl);
+            vfloat_t tz = vrow3(normal_matrix.m[2], nx, ny, nz, vl);
+            vnormalize3(&tx, &ty, &tz, vl);
+            vstore(out, VARYING(normal.x), ostride, tx, vl);
+            vstore(out, VARYING(normal.y), ostride, ty, vl);
+            vstore(out, VARYING(normal.z), ostride, tz, vl);
+        }
+        i += vl;
+    }
+}
@@ -1,6 +1,7 @@
 #include <math.h>
 #include <inttypes.h>
 #include "../maths.h"
+#include "../tex.h"
 
 typedef struct {
     int width, height;
@@ -8,12 +9,16 @@ typedef struct {
 } texture_t;
 
 vec4_t texture_repeat_sample(texture_t *texture, vec2_t texcoord) {
+#ifndef NO_TEX
+    return *tex_repeat(texture, texcoord);
+#else
     float u = texcoord.x - floorf(texcoord.x);
     float v = texcoord.y - floorf(texcoord.y);
     int c = (int)((texture->width - 1) * u);
     int r = (int)((texture->height - 1) * v);
     int index = r * texture->width + c;
     return texture->buffer[index];
+#endif
 }
 
 vec4_t texture_sample(texture_t *texture, vec2_t texcoord) {
@@ -35,6 +40,7 @@ typedef struct {
     vec3_t position;
     vec2_t texcoord;
     vec3_t normal;
+    vec4_t tangent;
     vec4_t joint;
     vec4_t weight;
 } blinn_attribs_t;
@@ -0,0 +1,187 @@
+#include <math.h>
+#include <inttypes.h>
+#include "../maths.h"
+
+typedef struct {
+    int width, height;
+    vec4_t *buffer;
+} texture_t;
+
+typedef struct {
+    texture_t *faces[6];
+} cubemap_t;
+
+// End texture
+
+typedef enum {
+    METALNESS_WORKFLOW,
+    SPECULAR_WORKFLOW
+} workflow_t;
+
+typedef struct {
+    int mip_levels;
+    cubemap_t *diffuse_map;
+    cubemap_t *specular_maps[15];
+    texture_t *brdf_lut;
+} ibldata_t;
+
+typedef struct {
+    vec3_t position;
+    vec2_t texcoord;
+    vec3_t normal;
+    vec4_t tangent;
+    vec4_t joint;
+    vec4_t weight;
+} pbr_attribs_t;
+
+typedef struct {
+    vec3_t world_position;
+    vec3_t depth_position;
+    vec4_t clip_position;
+    vec3_t world_normal;
+    vec3_t world_tangent;
+    vec3_t world_bitangent;
+    vec2_t texcoord;
+} pbr_varyings_t;
+
+typedef struct {
+    vec3_t light_dir;
+    vec3_t camera_pos;
+    mat4_t model_matrix;
+    mat3_t normal_matrix;
+    mat4_t light_vp_matrix;
+    mat4_t camera_vp_matrix;
+    mat4_t *joint_matrices;
+    mat3_t *joint_n_matrices;
+    float ambient_intensity;
+    float punctual_intensity;
+    texture_t *shadow_map;
+    /* metalness workflow */
+    vec4_t basecolor_factor;
+    float metalness_factor;
+    float roughness_factor;
+    texture_t *basecolor_map;
+    texture_t *metalness_map;
+    texture_t *roughness_map;
+    /* specular workflow */
+    vec4_t diffuse_factor;
+    vec3_t specular_factor;
+    float glossiness_factor;
+    texture_t *diffuse_map;
+    texture_t *specular_map;
+    texture_t *glossiness_map;
+    /* additional maps */
+    texture_t *normal_map;
+    texture_t *occlusion_map;
+    texture_t *emission_map;
+    /* environment maps */
+    ibldata_t *ibldata;
+    /* render controls */
+    workflow_t workflow;
+    float alpha_cutoff;
+    int shadow_pass;
+    int layer_view;
+} pbr_uniforms_t;
+
+static mat4_t get_model_matrix(pbr_attribs_t *attribs,
+                               pbr_uniforms_t *uniforms) {
+    if (uniforms->joint_matrices) {
+        mat4_t joint_matrices[4];
+        mat4_t skin_matrix;
+
+        joint_matrices[0] = uniforms->joint_matrices[(int)attribs->joint.x];
+        joint_matrices[1] = uniforms->joint_matrices[(int)attribs->joint.y];
+        joint_matrices[2] = uniforms->joint_matrices[(int)attribs->joint.z];
+        joint_matrices[3] = uniforms->joint_matrices[(int)attribs->joint.w];
+
+        skin_matrix = mat4_combine(joint_matrices, attribs->weight);
+        return mat4_mul_mat4(uniforms->model_matrix, skin_matrix);
+    } else {
+        return uniforms->model_matrix;
+    }
+}
+
+static mat3_t get_normal_matrix(pbr_attribs_t *attribs,
+                                pbr_uniforms_t *uniforms) {
+    if (uniforms->joint_n_matrices) {
+        mat3_t joint_n_matrices[4];
+        mat3_t skin_n_matrix;
+
+        joint_n_matrices[0] = uniforms->joint_n_matrices[(int)attribs->joint.x];
+        joint_n_matrices[1] = uniforms->joint_n_matrices[(int)attribs->joint.y];
+        joint_n_matrices[2] = uniforms->joint_n_matrices[(int)attribs->joint.z];
+        joint_n_matrices[3] = uniforms->joint_n_matrices[(int)attribs->joint.w];
+
+        skin_n_matrix = mat3_combine(joint_n_matrices, attribs->weight);
+        return mat3_mul_mat3(uniforms->normal_matrix, skin_n_matrix);
+    } else {
+        return uniforms->normal_matrix;
+    }
+}
+
+static vec4_t shadow_vertex_shader(pbr_attribs_t *attribs,
+                                   pbr_varyings_t *varyings,
+                                   pbr_uniforms_t *uniforms) {
+    mat4_t model_matrix = get_model_matrix(attribs, uniforms);
+    mat4_t light_vp_matrix = uniforms->light_vp_matrix;
+
+    vec4_t input_position = vec4_from_vec3(attribs->position, 1);
+    vec4_t world_position = mat4_mul_vec4(model_matrix, input_position);
+    vec4_t depth_position = mat4_mul_vec4(light_vp_matrix, world_position);
+
+    varyings->texcoord = attribs->texcoord;
+    return depth_position;
+}
+
+static vec4_t common_vertex_shader(pbr_attribs_t *attribs,
+                                   pbr_varyings_t *varyings,
+                                   pbr_uniforms_t *uniforms) {
+    mat4_t model_matrix = get_model_matrix(attribs, uniforms);
+    mat3_t normal_matrix = get_normal_matrix(attribs, uniforms);
+    mat4_t camera_vp_matrix = uniforms->camera_vp_matrix;
+    mat4_t light_vp_matrix = uniforms->light_vp_matrix;
+
+    vec4_t input_position = vec4_from_vec3(attribs->position, 1);
+    vec4_t world_position = mat4_mul_vec4(model_matrix, input_position);
+    vec4_t clip_position = mat4_mul_vec4(camera_vp_matrix, world_position);
+    vec4_t depth_position = mat4_mul_vec4(light_vp_matrix, world_position);
+
+    vec3_t input_normal = attribs->normal;
+    vec3_t world_normal = mat3_mul_vec3(normal_matrix, input_normal);
+
+    if (uniforms->normal_map) {
+        mat3_t tangent_matrix = mat3_from_mat4(model_matrix);
+        vec3_t input_tangent = vec3_from_vec4(attribs->tangent);
+        vec3_t world_tangent = mat3_mul_vec3(tangent_matrix, input_tangent);
+        vec3_t world_bitangent;
+
+        world_normal = vec3_normalize(world_normal);
+        world_tangent = vec3_normalize(world_tangent);
+        world_bitangent = vec3_cross(world_normal, world_tangent);
+        world_bitangent = vec3_mul(world_bitangent, attribs->tangent.w);
+
+        varyings->world_normal = world_normal;
+        varyings->world_tangent = world_tangent;
+        varyings->world_bitangent = world_bitangent;
+    } else {
+        varyings->world_normal = vec3_normalize(world_normal);
+    }
+
+    varyings->world_position = vec3_from_vec4(world_position);
+    varyings->depth_position = vec3_from_vec4(depth_position);
+    varyings->clip_position = clip_position;
+    varyings->texcoord = attribs->texcoord;
+    return clip_position;
+}
+
+vec4_t vertPbr(void *attribs_, void *varyings_, void *uniforms_) {
+    pbr_attribs_t *attribs = (pbr_attribs_t*)attribs_;
+    pbr_varyings_t *varyings = (pbr_varyings_t*)varyings_;
+    pbr_uniforms_t *uniforms = (pbr_uniforms_t*)uniforms_;
+
+    if (uniforms->shadow_pass) {
+        return shadow_vertex_shader(attribs, varyings, uniforms);
+    } else {
+        return common_vertex_shader(attribs, varyings, uniforms);
+    }
+}
@@ -0,0 +1,41 @@
+#include <math.h>
+#include <inttypes.h>
+#include "../maths.h"
+#include "../macro.h"
+
+typedef struct {
+    int width, height;
+    vec4_t *buffer;
+} texture_t;
+
+typedef struct {
+    texture_t *faces[6];
+} cubemap_t;
+
+// End texture
+
+typedef struct {
+    vec3_t position;
+} skybox_attribs_t;
+
+typedef struct {
+    vec3_t direction;
+} skybox_varyings_t;
+
+typedef struct {
+    mat4_t vp_matrix;
+    cubemap_t *skybox;
+} skybox_uniforms_t;
+
+vec4_t vertSkybox(void *attribs_, void *varyings_, void *uniforms_) {
+    skybox_attribs_t *attribs = (skybox_attribs_t*)attribs_;
+    skybox_varyings_t *varyings = (skybox_varyings_t*)varyings_;
+    skybox_uniforms_t *uniforms = (skybox_uniforms_t*)uniforms_;
+
+    vec4_t local_pos = vec4_from_vec3(attribs->position, 1);
+    vec4_t clip_pos = mat4_mul_vec4(uniforms->vp_matrix, local_pos);
+    clip_pos.z = clip_pos.w * (1 - EPSILON);
+
+    varyings->direction = attribs->position;
+    return clip_pos;
+}
@@ -0,0 +1,28 @@
+#ifndef _STFB_H
+#define _STFB_H
+
+#include <stddef.h>
+#include <inttypes.h>
+
+// define this macro to disable usage of stfb instruction
+#define NO_STFB 1
+
+// Update fbaddr CSR to the given value.
+void update_fbaddr(unsigned char* addr) __attribute__ ((noinline));
+// Draw the given pixel at the specified offset in the framebuffer.
+void draw(uint32_t pixel, ptrdiff_t offset) __attribute__ ((noinline));
+// Update zbaddr CSR to the given depth buffer.
+void update_zbaddr(float* addr);
+// Draw the given pixel at the specified offset if depth passes the depth test
+// (less or equal), writing depth too. Returns nonzero if it passed.
+int draw_depth(uint32_t pixel, float depth, ptrdiff_t offset);
+// Update fbwidth CSR to the width of the framebuffer in pixels, used by draw_quad.
+void update_fbwidth(uint64_t width);
+// Draw the pixels whose bit is set in mask (bit i for pixels[i]) of the span of
+// 4 pixels starting at the specified offset, with one stfbs.
+void draw_span(const uint32_t pixels[4], ptrdiff_t offset, unsigned mask);
+// Same for the 2x2 quad whose top left pixel is at the specified offset, with
+// one stfbq. Pixels are in row order.
+void draw_quad(const uint32_t pixels[4], ptrdiff_t offset, unsigned mask);
+
+#endif /* _STFB_H */
@@ -0,0 +1,179 @@
+// Test of the custom instructions added by stfb.patch, built by
+// build_riscv.sh and run on a patched spike with: spike -p1 stfb_test.rv64
+// Spike exits with 0 if every check passed, otherwise with the number of
+// failed checks.
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define WIDTH  8
+#define HEIGHT 4
+
+extern volatile uint64_t tohost; // see start.S
+
+static uint32_t color_buffer[WIDTH * HEIGHT];
+static float depth_buffer[WIDTH * HEIGHT];
+static uint32_t expected[WIDTH * HEIGHT];
+static int failures;
+
+static void stfb(uint32_t pixel, uint64_t offset)
+{
+    __asm__ volatile(".insn s 0xB, 0x0, %0, 0(%1)" : : "r"(pixel), "r"(offset) : "memory");
+}
+
+static int stfbz(uint32_t pixel, float depth, uint64_t offset)
+{
+    uint32_t depth_bits;
+    int pass;
+    memcpy(&depth_bits, &depth, sizeof(depth_bits));
+    __asm__ volatile(".insn r4 0xB, 0x1, 0x0, %0, %1, %2, %3"
+                     : "=r"(pass) : "r"(offset), "r"(pixel), "r"(depth_bits) : "memory");
+    return pass;
+}
+
+// First operand of stfbs and stfbq: index of the first pixel and coverage mask.
+static uint64_t block(uint64_t offset, unsigned mask)
+{
+    return offset | (uint64_t) mask << 32;
+}
+
+static uint64_t pair(uint32_t first, uint32_t second)
+{
+    return first | (uint64_t) second << 32;
+}
+
+static void stfbs(uint64_t first, uint64_t p01, uint64_t p23)
+{
+    __asm__ volatile(".insn r4 0xB, 0x2, 0x0, x0, %0, %1, %2" : : "r"(first), "r"(p01), "r"(p23) : "memory");
+}
+
+static void stfbq(uint64_t first, uint64_t top, uint64_t bottom)
+{
+    __asm__ volatile(".insn r4 0xB, 0x2, 0x1, x0, %0, %1, %2" : : "r"(first), "r"(top), "r"(bottom) : "memory");
+}
+
+// Same layout as texture_t of the renderer and the shaders.
+typedef struct {
+    int width, height;
+    float (*buffer)[4];
+} texture_t;
+
+static float texels[3 * 5][4];
+static texture_t texture = { 3, 5, texels };
+
+static void *tex_repeat(const texture_t *t, float u, float v)
+{
+    void *texel;
+    __asm__ volatile(".insn r4 0x2B, 0x0, 0x0, %0, %1, %2, %3" : "=r"(texel) : "r"(t), "f"(u), "f"(v) : "memory");
+    return texel;
+}
+
+static void *tex_clamp(const texture_t *t, float u, float v)
+{
+    void *texel;
+    __asm__ volatile(".insn r4 0x2B, 0x1, 0x0, %0, %1, %2, %3" : "=r"(texel) : "r"(t), "f"(u), "f"(v) : "memory");
+    return texel;
+}
+
+// Texel chosen by texture_repeat_sample and texture_clamp_sample of the shaders.
+static void *repeat_texel(const texture_t *t, float u, float v)
+{
+    u -= floorf(u);
+    v -= floorf(v);
+    return t->buffer[(int) ((t->height - 1) * v) * t->width + (int) ((t->width - 1) * u)];
+}
+
+static void *clamp_texel(const texture_t *t, float u, float v)
+{
+    u = u < 0 ? 0 : (u > 1 ? 1 : u);
+    v = v < 0 ? 0 : (v > 1 ? 1 : v);
+    return t->buffer[(int) ((t->height - 1) * v) * t->width + (int) ((t->width - 1) * u)];
+}
+
+static void check(bool condition)
+{
+    if (!condition)
+        ++failures;
+}
+
+static void check_colors(void)
+{
+    check(memcmp(color_buffer, expected, sizeof(expected)) == 0);
+}
+
+int main(void)
+{
+    uint64_t hart;
+    __asm__ volatile("csrr %0, mhartid" : "=r"(hart));
+    if (hart != 0)
+        return 0;
+
+    memset(color_buffer, 0, sizeof(color_buffer));
+    memset(expected, 0, sizeof(expected));
+    for (int i = 0; i < WIDTH * HEIGHT; ++i)
+        depth_buffer[i] = 1.0f;
+    __asm__ volatile("csrw 0x800, %0" : : "r"(color_buffer));
+    __asm__ volatile("csrw 0x801, %0" : : "r"(depth_buffer));
+    __asm__ volatile("csrw 0x802, %0" : : "r"((uint64_t) WIDTH));
+
+    // stfb: one pixel.
+    stfb(0x11, 3);
+    expected[3] = 0x11;
+    check_colors();
+
+    // stfbs: a full span, then every other pixel of the next one.
+    stfbs(block(8, 0xf), pair(0x21, 0x22), pair(0x23, 0x24));
+    expected[8] = 0x21;
+    expected[9] = 0x22;
+    expected[10] = 0x23;
+    expected[11] = 0x24;
+    check_colors();
+    stfbs(block(12, 0x5), pair(0x25, 0x26), pair(0x27, 0x28));
+    expected[12] = 0x25;
+    expected[14] = 0x27;
+    check_colors();
+
+    // stfbq: a full quad, then its right column only, then nothing.
+    stfbq(block(2 * WIDTH + 2, 0xf), pair(0x31, 0x32), pair(0x33, 0x34));
+    expected[2 * WIDTH + 2] = 0x31;
+    expected[2 * WIDTH + 3] = 0x32;
+    expected[3 * WIDTH + 2] = 0x33;
+    expected[3 * WIDTH + 3] = 0x34;
+    check_colors();
+    stfbq(block(2 * WIDTH + 5, 0xa), pair(0x35, 0x36), pair(0x37, 0x38));
+    expected[2 * WIDTH + 6] = 0x36;
+    expected[3 * WIDTH + 6] = 0x38;
+    check_colors();
+    stfbq(block(0, 0), pair(0x39, 0x39), pair(0x39, 0x39));
+    check_colors();
+
+    // stfbz: passes when nearer or equal, leaves both buffers alone otherwise.
+    check(stfbz(0x41, 0.5f, 1) == 1);
+    expected[1] = 0x41;
+    check_colors();
+    check(depth_buffer[1] == 0.5f);
+    check(stfbz(0x42, 0.75f, 1) == 0);
+    check_colors();
+    check(depth_buffer[1] == 0.5f);
+    check(stfbz(0x43, 0.5f, 1) == 1);
+    expected[1] = 0x43;
+    check_colors();
+
+    // tex.repeat and tex.clamp: inside, on the edges and outside of [0, 1].
+    static const float coords[][2] = {
+        { 0.0f, 0.0f }, { 0.3f, 0.7f }, { 0.999f, 0.5f }, { 1.0f, 1.0f },
+        { 1.25f, -0.25f }, { -3.6f, 2.1f }, { 0.5f, 7.75f },
+    };
+    for (unsigned i = 0; i < sizeof(coords) / sizeof(coords[0]); ++i) {
+        float u = coords[i][0], v = coords[i][1];
+        check(tex_repeat(&texture, u, v) == repeat_texel(&texture, u, v));
+        check(tex_clamp(&texture, u, v) == clamp_texel(&texture, u, v));
+    }
+
+    if (failures) {
+        tohost = (uint64_t) failures << 1 | 1;
+        while (true) { /* wait for spike to exit */ }
+    }
+    return 0;
+}
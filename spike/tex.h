@@ -0,0 +1,32 @@
+#ifndef _TEX_H
+#define _TEX_H
+
+#include "maths.h"
+
+// define this macro to disable usage of tex.repeat and tex.clamp instructions
+#define NO_TEX 1
+
+#ifndef NO_TEX
+// Address of the texel of texture (a texture_t) at texcoord, which wraps
+// around outside of [0, 1]. Computed by one tex.repeat, the texel is then
+// loaded as usual. Textures are never written by shaders, so the instruction
+// has no memory dependencies.
+static inline const vec4_t *tex_repeat(const void *texture, vec2_t texcoord)
+{
+    const vec4_t *texel;
+    __asm__(".insn r4 0x2B, 0x0, 0x0, %0, %1, %2, %3"
+            : "=r"(texel) : "r"(texture), "f"(texcoord.x), "f"(texcoord.y));
+    return texel;
+}
+
+// Same with texcoord clamped to [0, 1], one tex.clamp.
+static inline const vec4_t *tex_clamp(const void *texture, vec2_t texcoord)
+{
+    const vec4_t *texel;
+    __asm__(".insn r4 0x2B, 0x1, 0x0, %0, %1, %2, %3"
+            : "=r"(texel) : "r"(texture), "f"(texcoord.x), "f"(texcoord.y));
+    return texel;
+}
+#endif
+
+#endif /* _TEX_H */
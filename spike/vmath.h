@@ -0,0 +1,95 @@
+#ifndef _VMATH_H
+#define _VMATH_H
+
+#include <stddef.h>
+#include <riscv_vector.h>
+
+// Helpers of the batch shaders (see shaders/vertAV.c). Vertices and fragments
+// stay in the layout the host gives them (an array of structs), a vector holds
+// the same component of vl consecutive elements, loaded and stored with
+// strided accesses. Every helper works on the first vl elements.
+
+typedef vfloat32m1_t vfloat_t;
+typedef vbool32_t vmask_t;
+
+// Component at offset bytes into every element, elements are stride bytes apart.
+static inline vfloat_t vload(const void *first, size_t offset, ptrdiff_t stride, size_t vl)
+{
+    return __riscv_vlse32_v_f32m1((const float*) ((const unsigned char*) first + offset), stride, vl);
+}
+
+static inline void vstore(void *first, size_t offset, ptrdiff_t stride, vfloat_t v, size_t vl)
+{
+    __riscv_vsse32_v_f32m1((float*) ((unsigned char*) first + offset), stride, v, vl);
+}
+
+// Nonzero 32-bit integer component at offset bytes into every element.
+static inline vmask_t vload_flag(const void *first, size_t offset, ptrdiff_t stride, size_t vl)
+{
+    vint32m1_t v = __riscv_vlse32_v_i32m1((const int32_t*) ((const unsigned char*) first + offset), stride, vl);
+    return __riscv_vmsne_vx_i32m1_b32(v, 0, vl);
+}
+
+// Store 1 where mask is set and 0 elsewhere as a 32-bit integer component.
+static inline void vstore_flag(void *first, size_t offset, ptrdiff_t stride, vmask_t mask, size_t vl)
+{
+    vint32m1_t zero = __riscv_vmv_v_x_i32m1(0, vl);
+    vint32m1_t v = __riscv_vmerge_vxm_i32m1(zero, 1, mask, vl);
+    __riscv_vsse32_v_i32m1((int32_t*) ((unsigned char*) first + offset), stride, v, vl);
+}
+
+static inline vfloat_t vsplat(float f, size_t vl)
+{
+    return __riscv_vfmv_v_f_f32m1(f, vl);
+}
+
+// Dot product of a matrix row with (x, y, z, w).
+static inline vfloat_t vrow4(const float row[4], vfloat_t x, vfloat_t y, vfloat_t z, vfloat_t w, size_t vl)
+{
+    vfloat_t r = __riscv_vfmul_vf_f32m1(x, row[0], vl);
+    r = __riscv_vfmacc_vf_f32m1(r, row[1], y, vl);
+    r = __riscv_vfmacc_vf_f32m1(r, row[2], z, vl);
+    return __riscv_vfmacc_vf_f32m1(r, row[3], w, vl);
+}
+
+// Dot product of a matrix row with the point (x, y, z, 1).
+static inline vfloat_t vrow4_point(const float row[4], vfloat_t x, vfloat_t y, vfloat_t z, size_t vl)
+{
+    vfloat_t r = __riscv_vfmul_vf_f32m1(x, row[0], vl);
+    r = __riscv_vfmacc_vf_f32m1(r, row[1], y, vl);
+    r = __riscv_vfmacc_vf_f32m1(r, row[2], z, vl);
+    return __riscv_vfadd_vf_f32m1(r, row[3], vl);
+}
+
+// Dot product of a matrix row with (x, y, z).
+static inline vfloat_t vrow3(const float row[3], vfloat_t x, vfloat_t y, vfloat_t z, size_t vl)
+{
+    vfloat_t r = __riscv_vfmul_vf_f32m1(x, row[0], vl);
+    r = __riscv_vfmacc_vf_f32m1(r, row[1], y, vl);
+    return __riscv_vfmacc_vf_f32m1(r, row[2], z, vl);
+}
+
+static inline vfloat_t vdot3(vfloat_t ax, vfloat_t ay, vfloat_t az, vfloat_t bx, vfloat_t by, vfloat_t bz,
+                             size_t vl)
+{
+    vfloat_t r = __riscv_vfmul_vv_f32m1(ax, bx, vl);
+    r = __riscv_vfmacc_vv_f32m1(r, ay, by, vl);
+    return __riscv_vfmacc_vv_f32m1(r, az, bz, vl);
+}
+
+// Normalize (x, y, z) in place, like vec3_normalize.
+static inline void vnormalize3(vfloat_t *x, vfloat_t *y, vfloat_t *z, size_t vl)
+{
+    vfloat_t length = __riscv_vfsqrt_v_f32m1(vdot3(*x, *y, *z, *x, *y, *z, vl), vl);
+    *x = __riscv_vfdiv_vv_f32m1(*x, length, vl);
+    *y = __riscv_vfdiv_vv_f32m1(*y, length, vl);
+    *z = __riscv_vfdiv_vv_f32m1(*z, length, vl);
+}
+
+// a where mask is set, b elsewhere.
+static inline vfloat_t vselect(vmask_t mask, vfloat_t a, vfloat_t b, size_t vl)
+{
+    return __riscv_vmerge_vvm_f32m1(b, a, mask, vl);
+}
+
+#endif /* _VMATH_H */